@@ -34,7 +34,11 @@
 @interface NSColor (QHexColor)
 
 + (NSColor *)colorFromHexString:(NSString *)hex;
++ (NSColor *)colorFromPackedRGBA:(uint32_t)rgba;
 - (NSString *)toHexColorString;
+// Returns the color as 0xRRGGBBAA using the same quantization as
+// toHexColorString (i.e., alpha is 0xFF if the hex string would omit it).
+- (uint32_t)toPackedRGBA;
 - (NSColor *)forScheme;
 
 @end
@@ -78,6 +78,17 @@ q_ftoub(CGFloat f)
 }
 
 
++ (NSColor *)colorFromPackedRGBA:(uint32_t)rgba
+{
+  CGFloat red = ((CGFloat)((rgba >> 24) & 0xFF)) / 255.0;
+  CGFloat green = ((CGFloat)((rgba >> 16) & 0xFF)) / 255.0;
+  CGFloat blue = ((CGFloat)((rgba >> 8) & 0xFF)) / 255.0;
+  CGFloat alpha = ((CGFloat)(rgba & 0xFF)) / 255.0;
+
+  return [NSColor colorWithRed:red green:green blue:blue alpha:alpha];
+}
+
+
 - (NSString *)toHexColorString
 {
   NSColor *valid = [self forScheme];
@@ -108,4 +119,25 @@ q_ftoub(CGFloat f)
   return nil;
 }
 
+
+- (uint32_t)toPackedRGBA
+{
+  NSColor *valid = [self forScheme];
+
+  CGFloat red = 0.0f;
+  CGFloat green = 0.0f;
+  CGFloat blue = 0.0f;
+  CGFloat alpha = 0.0f;
+
+  [valid getRed:&red green:&green blue:&blue alpha:&alpha];
+
+  uint32_t packedAlpha = alpha < ONE_EPSILON ? q_ftoub(alpha) : 0xFF;
+
+  return
+      ((uint32_t)q_ftoub(red) << 24)
+    | ((uint32_t)q_ftoub(green) << 16)
+    | ((uint32_t)q_ftoub(blue) << 8)
+    | packedAlpha;
+}
+
 @end
@@ -32,6 +32,7 @@
 
 
 @class QScheme;
+@class QSchemeRule;
 @class QRulesTableDelegate;
 
 
@@ -40,4 +41,21 @@
 @property (strong, readonly) QScheme *scheme;
 @property (strong, readonly) QRulesTableDelegate *rulesTableDelegate;
 
+// Whether documents reopen themes from, and keep up to date, the snapshots
+// described in QScheme+QSnapshot.h. YES by default.
++ (BOOL)cachesSnapshots;
++ (void)setCachesSnapshots:(BOOL)cachesSnapshots;
+// Snapshots are written in the background after opening or saving a theme.
+// Blocks until every snapshot write queued so far has finished.
++ (void)waitForSnapshotWrites;
+
+// The edits behind the buttons that add and remove rules and selectors, minus
+// updating the tables. The appending methods return the new row's index.
+- (NSUInteger)appendRule:(QSchemeRule *)rule;
+- (void)removeRulesAtIndexes:(NSIndexSet *)indices;
+- (NSUInteger)appendSelector:(NSString *)selector toRule:(QSchemeRule *)rule;
+- (void)
+  removeSelectorsAtIndexes:(NSIndexSet *)indices
+                  fromRule:(QSchemeRule *)rule;
+
 @end
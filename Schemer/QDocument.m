@@ -30,6 +30,8 @@
 
 #import "QDocument.h"
 #import "QScheme.h"
+#import "QScheme+QJSON.h"
+#import "QScheme+QSnapshot.h"
 #import "QSchemeRule.h"
 #import "QRulesTableData.h"
 #import "QRulesTableDelegate.h"
@@ -37,6 +39,8 @@
 #import "NSObject+QNull.h"
 #import "QSelectorTableSource.h"
 #import "QAppDelegate.h"
+#import "QPreviewController.h"
+#import "QPreviewSource.h"
 
 
 static NSDragOperation const QDragOpsMask =
@@ -44,6 +48,16 @@ static NSDragOperation const QDragOpsMask =
   NSDragOperationCopy;
 
 
+static NSString *const QColorSchemeType = @"tmTheme";
+static NSString *const QColorSchemeJSONType = @"sublime-color-scheme";
+
+
+static BOOL g_cachesSnapshots = YES;
+// Snapshots past either limit are deleted, least recently written first.
+static NSUInteger const QSnapshotCacheCount = 64;
+static uint64_t const QSnapshotCacheBytes = 64 * 1024 * 1024;
+
+
 static NSKeyValueObservingOptions const QCaptureObservedChanges =
   NSKeyValueObservingOptionNew |
   NSKeyValueObservingOptionOld;
@@ -92,6 +106,23 @@ static NSArray *observedSchemeRulePaths()
 }
 
 
+static
+NSHashTable *
+identitySetWithArray(NSArray *objects)
+{
+  NSHashTable *set =
+    [[NSHashTable alloc]
+     initWithOptions:NSPointerFunctionsObjectPointerPersonality
+            capacity:[objects count]];
+
+  for (id obj in objects) {
+    [set addObject:obj];
+  }
+
+  return set;
+}
+
+
 #pragma mark Private API for QRulesTableDelegate
 
 @interface QRulesTableDelegate ()
@@ -115,6 +146,8 @@ static NSArray *observedSchemeRulePaths()
 @property (strong) IBOutlet QSelectorTableSource *selectorData;
 @property (weak) IBOutlet NSButton *removeSelectorsButton;
 
+@property (strong) QPreviewController *previewController;
+
 @property (strong) id rulesTableObserverKey;
 @property (strong) id selectorTableObserverKey;
 
@@ -125,6 +158,14 @@ static NSArray *observedSchemeRulePaths()
 
 @implementation QDocument {
   NSInteger _midUpdate;
+  // Content hash of the scheme as of the last read or save.
+  uint64_t _savedContentHash;
+  // Content hash of the scheme as of the last write, which only becomes the
+  // saved hash once the write has gone through.
+  uint64_t _writtenContentHash;
+  // Property list handed to the last write, kept until the write is done so
+  // the snapshot can be built from what's actually in the file.
+  NSDictionary *_writtenPropertyList;
 }
 
 - (void)dealloc
@@ -248,6 +289,81 @@ static NSArray *observedSchemeRulePaths()
 }
 
 
+#pragma mark Snapshots
+
+static
+dispatch_queue_t
+snapshotQueue()
+{
+  static dispatch_queue_t snapshot_queue = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    snapshot_queue = dispatch_queue_create(
+      "net.spifftastic.schemer.snapshot",
+      DISPATCH_QUEUE_SERIAL
+      );
+    dispatch_set_target_queue(
+      snapshot_queue,
+      dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0)
+      );
+  });
+  return snapshot_queue;
+}
+
+
+// Snapshots are only a cache, so they're written in the background once the
+// open or save that calls for one is done, and failing to write one is logged
+// and otherwise ignored. The scheme is rebuilt from the property list on the
+// snapshot queue rather than shared with the document, which may be editing
+// it by then, and the snapshot gets the stamp the caller took when the file
+// was read or written, so a file that's changed since is never vouched for.
+static
+void
+writeSnapshotInBackground(
+  NSDictionary *plist,
+  NSURL *url,
+  uint64_t size,
+  NSDate *modified
+  )
+{
+  dispatch_async(snapshotQueue(), ^{
+    @autoreleasepool {
+      QScheme *scheme = [[QScheme alloc] initWithPropertyList:plist];
+      NSError *error = nil;
+
+      if (![scheme writeSnapshotForURL:url
+                            sourceSize:size
+                          modifiedDate:modified
+                                 error:&error]) {
+        NSLog(@"Unable to write snapshot for %@: %@", url, error);
+        return;
+      }
+
+      [QScheme trimSnapshotsToCount:QSnapshotCacheCount
+                              bytes:QSnapshotCacheBytes];
+    }
+  });
+}
+
+
++ (void)waitForSnapshotWrites
+{
+  dispatch_sync(snapshotQueue(), ^{});
+}
+
+
++ (BOOL)cachesSnapshots
+{
+  return g_cachesSnapshots;
+}
+
+
++ (void)setCachesSnapshots:(BOOL)cachesSnapshots
+{
+  g_cachesSnapshots = cachesSnapshots;
+}
+
+
 #pragma mark NSDocument
 
 + (BOOL)usesUbiquitousStorage
@@ -282,11 +398,51 @@ static NSArray *observedSchemeRulePaths()
 }
 
 
+// .sublime-color-scheme files can hold variables, color expressions, and keys
+// QScheme doesn't model, none of which survive being written back out. So
+// they're opened as imports -- an untitled tmTheme document -- and autosaving
+// can never overwrite the original. Writing JSON is only offered as an
+// explicit export.
+- (id)
+  initWithContentsOfURL:(NSURL *)url
+                 ofType:(NSString *)typeName
+                  error:(NSError *__autoreleasing *)outError
+{
+  self = [super initWithContentsOfURL:url ofType:typeName error:outError];
+
+  if (self && [typeName isEqualToString:QColorSchemeJSONType]) {
+    self.fileURL = nil;
+    self.fileType = QColorSchemeType;
+    self.displayName = [url.lastPathComponent stringByDeletingPathExtension];
+  }
+
+  return self;
+}
+
+
+- (NSArray *)writableTypesForSaveOperation:(NSSaveOperationType)saveOperation
+{
+  NSArray *types = [super writableTypesForSaveOperation:saveOperation];
+
+  if (   saveOperation == NSSaveToOperation
+      && ![types containsObject:QColorSchemeJSONType]) {
+    types = [types arrayByAddingObject:QColorSchemeJSONType];
+  }
+
+  return types;
+}
+
+
 - (BOOL)
   writeToURL:(NSURL *)url
       ofType:(NSString *)typeName
        error:(NSError *__autoreleasing *)outError
 {
+  if ([typeName isEqualToString:QColorSchemeJSONType]) {
+    return [self writeJSONToURL:url ofType:typeName error:outError];
+  }
+
+  uint64_t contentHash = self.scheme.contentHash;
   NSDictionary *plist = [self.scheme toPropertyList];
 
   if (!plist) {
@@ -319,6 +475,79 @@ static NSArray *observedSchemeRulePaths()
     return NO;
   }
 
+  _writtenContentHash = contentHash;
+  _writtenPropertyList = plistWithName;
+
+  return YES;
+}
+
+
+- (BOOL)
+  writeJSONToURL:(NSURL *)url
+          ofType:(NSString *)typeName
+           error:(NSError *__autoreleasing *)outError
+{
+  NSString *name = [url.lastPathComponent stringByDeletingPathExtension];
+  uint64_t contentHash = self.scheme.contentHash;
+  NSData *json = [self.scheme toJSONDataWithName:name];
+
+  if (![json writeToURL:url atomically:NO]) {
+    NSDictionary *info = @{
+      @"url": url,
+      @"type": typeName
+    };
+    if (outError) {
+      *outError = [NSError errorWithDomain:@"QCannotWriteJSON"
+                                      code:3
+                                  userInfo:info];
+    }
+    return NO;
+  }
+
+  _writtenContentHash = contentHash;
+
+  return YES;
+}
+
+
+- (BOOL)
+  readJSONFromURL:(NSURL *)url
+           ofType:(NSString *)typeName
+            error:(NSError *__autoreleasing *)outError
+{
+  NSError *error = nil;
+  NSData *json = [NSData dataWithContentsOfURL:url
+                                       options:NSDataReadingMappedIfSafe
+                                         error:&error];
+  QScheme *scheme = nil;
+
+  if (json) {
+    scheme = [[QScheme alloc] initWithJSONData:json error:&error];
+  }
+
+  if (nil == scheme) {
+    NSMutableDictionary *info = [@{
+      @"url": url,
+      @"type": typeName
+    } mutableCopy];
+    if (error) {
+      info[NSUnderlyingErrorKey] = error;
+    }
+    if (outError) {
+      *outError = [NSError errorWithDomain:QInvalidJSONErrorDomain
+                                      code:1
+                                  userInfo:info];
+    }
+    return NO;
+  }
+
+  self.scheme = scheme;
+  _savedContentHash = scheme.contentHash;
+
+  if (self.rulesTable) {
+    [self bindTableView];
+  }
+
   return YES;
 }
 
@@ -328,6 +557,35 @@ static NSArray *observedSchemeRulePaths()
        ofType:(NSString *)typeName
         error:(NSError *__autoreleasing *)outError
 {
+  if ([typeName isEqualToString:QColorSchemeJSONType]) {
+    return [self readJSONFromURL:url ofType:typeName error:outError];
+  }
+
+  QScheme *snapshot = nil;
+  uint64_t size = 0;
+  NSDate *modified = nil;
+  BOOL hasStamp = NO;
+
+  if (g_cachesSnapshots) {
+    snapshot = [[QScheme alloc] initWithSnapshotOfURL:url];
+    // Taken before reading the file, so a snapshot of it can't be stamped
+    // with a newer version of the file.
+    hasStamp = !snapshot && [QScheme getSnapshotStampOfURL:url
+                                                      size:&size
+                                              modifiedDate:&modified];
+  }
+
+  if (snapshot) {
+    self.scheme = snapshot;
+    _savedContentHash = snapshot.contentHash;
+
+    if (self.rulesTable) {
+      [self bindTableView];
+    }
+
+    return YES;
+  }
+
   NSDictionary *plist = [NSDictionary dictionaryWithContentsOfURL:url];
 
   if (nil == plist) {
@@ -344,6 +602,11 @@ static NSArray *observedSchemeRulePaths()
   }
 
   self.scheme = [[QScheme alloc] initWithPropertyList:plist];
+  _savedContentHash = self.scheme.contentHash;
+
+  if (hasStamp) {
+    writeSnapshotInBackground(plist, url, size, modified);
+  }
 
   if (self.rulesTable) {
     [self bindTableView];
@@ -353,6 +616,54 @@ static NSArray *observedSchemeRulePaths()
 }
 
 
+- (BOOL)
+  writeSafelyToURL:(NSURL *)url
+            ofType:(NSString *)typeName
+  forSaveOperation:(NSSaveOperationType)saveOperation
+             error:(NSError *__autoreleasing *)outError
+{
+  _writtenPropertyList = nil;
+
+  if (![super writeSafelyToURL:url
+                        ofType:typeName
+              forSaveOperation:saveOperation
+                         error:outError]) {
+    _writtenPropertyList = nil;
+    return NO;
+  }
+
+  // Every save in place, including autosaves (which never clear the change
+  // count), leaves the file holding what was written. Autosaving elsewhere
+  // doesn't touch the file.
+  if (saveOperation != NSAutosaveElsewhereOperation) {
+    _savedContentHash = _writtenContentHash;
+  }
+
+  // Done here rather than in -writeToURL:ofType:error:, which may be handed a
+  // temporary URL -- the snapshot has to be stamped with the final file. It's
+  // built from the property list that was written rather than self.scheme,
+  // since writing and rereading a scheme normalizes some of its colors and a
+  // snapshot has to match what reading the file would produce. Autosaves to
+  // elsewhere are skipped: nobody opens those files by hand, so snapshots of
+  // them would only crowd real themes out of the cache.
+  uint64_t size = 0;
+  NSDate *modified = nil;
+
+  if (   _writtenPropertyList
+      && g_cachesSnapshots
+      && saveOperation != NSAutosaveElsewhereOperation
+      && [QScheme getSnapshotStampOfURL:url
+                                   size:&size
+                           modifiedDate:&modified]) {
+    writeSnapshotInBackground(_writtenPropertyList, url, size, modified);
+  }
+
+  _writtenPropertyList = nil;
+
+  return YES;
+}
+
+
 - (BOOL)
   revertToContentsOfURL:(NSURL *)url
                  ofType:(NSString *)typeName
@@ -367,6 +678,17 @@ static NSArray *observedSchemeRulePaths()
 }
 
 
+// Marks the document clean if its content is back to what was last read or
+// saved, so edits that cancel out (e.g., toggling a flag twice) don't cause
+// another save.
+- (void)clearChangesIfUnmodified
+{
+  if (self.fileURL && self.scheme.contentHash == _savedContentHash) {
+    [self updateChangeCount:NSChangeCleared];
+  }
+}
+
+
 #pragma mark Key-value observing
 
 - (void)
@@ -384,12 +706,17 @@ static NSArray *observedSchemeRulePaths()
       QScheme *newScheme = [change[NSKeyValueChangeNewKey] selfIfNotNull];
       [self rebindObservationFromOldScheme:oldScheme
                                toNewScheme:newScheme];
+
+      if (newScheme) {
+        self.previewController.scheme = newScheme;
+      }
     } break;
 
     default: break;
     }
   } else if (object == self.scheme) {
     [self updateChangeCount:NSChangeDone];
+    [self clearChangesIfUnmodified];
 
     if ([keyPath isEqualToString:@"rules"]) {
       NSArray *oldRules = [change[NSKeyValueChangeOldKey] selfIfNotNull];
@@ -399,10 +726,17 @@ static NSArray *observedSchemeRulePaths()
       if (self.rulesTable && _midUpdate == 0) {
         [self.rulesTable reloadData];
       }
+
+      [self.previewController rulesDidChange];
+    } else {
+      [self.previewController schemeColorsDidChange];
     }
   } else if ([object isKindOfClass:[QSchemeRule class]]) {
-    // a rule changed
+    // a rule changed -- e.g., via the color wells or flags in the rules table.
+    // The preview only restyles the ranges this rule applies to.
     [self updateChangeCount:NSChangeDone];
+    [self clearChangesIfUnmodified];
+    [self.previewController rule:object didChangeKeyPath:keyPath];
   }
 }
 
@@ -434,47 +768,19 @@ static NSArray *observedSchemeRulePaths()
   // TODO: Replace rebind with use of addObserver:toObjectsAtIndexes:for...
   NSArray *paths = observedSchemeRulePaths();
 
-  NSSet *oldRules = nil;
-  NSSet *newRules = nil;
-  NSUInteger oldRulesCount = 0;
-  NSUInteger newRulesCount = 0;
-
-  if (oldRulesArray && (oldRulesCount = [oldRulesArray count])) {
-    oldRules = [NSSet setWithArray:oldRulesArray];
-  } else {
-    oldRules = [NSSet set];
-  }
-
-  if (newRulesArray && (newRulesCount = [newRulesArray count])) {
-    newRules = [NSSet setWithArray:newRulesArray];
-  } else {
-    newRules = [NSSet set];
-  }
-
-  if (oldRulesCount) {
-    NSSet *filtered = oldRules;
+  // Rules compare by content, so observation has to be diffed by identity --
+  // two distinct rules with the same content each need their own observer.
+  NSHashTable *oldRules = identitySetWithArray(oldRulesArray);
+  NSHashTable *newRules = identitySetWithArray(newRulesArray);
 
-    if (newRulesCount) {
-      filtered = [oldRules rejectedBy:^(id obj) {
-        return [newRules containsObject:obj];
-      }];
-    }
-
-    for (QSchemeRule *rule in filtered) {
+  for (QSchemeRule *rule in oldRules) {
+    if (![newRules containsObject:rule]) {
       [self rebindObservationFromOldObject:rule toNewObject:nil forPaths:paths];
     }
   }
 
-  if (newRulesCount) {
-    NSSet *filtered = newRules;
-
-    if (oldRulesCount) {
-      filtered = [newRules rejectedBy:^(id obj) {
-        return [oldRules containsObject:obj];
-      }];
-    }
-
-    for (QSchemeRule *rule in filtered) {
+  for (QSchemeRule *rule in newRules) {
+    if (![oldRules containsObject:rule]) {
       [self rebindObservationFromOldObject:nil toNewObject:rule forPaths:paths];
     }
   }
@@ -528,18 +834,70 @@ static NSArray *observedSchemeRulePaths()
 }
 
 
+#pragma mark Preview
+
+- (IBAction)showPreview:(id)sender
+{
+  QPreviewController *preview = self.previewController;
+
+  if (!preview) {
+    preview = [[QPreviewController alloc]
+               initWithScheme:self.scheme
+                       source:[QPreviewSource bundledSample]];
+    self.previewController = preview;
+  }
+
+  if (![self.windowControllers containsObject:preview]) {
+    [self addWindowController:preview];
+  }
+
+  [preview showWindow:sender];
+}
+
+
 #pragma mark Add / remove rules
 
+- (NSUInteger)appendRule:(QSchemeRule *)rule
+{
+  NSUInteger index  = [self.scheme.rules count];
+  self.scheme.rules = [self.scheme.rules arrayByAddingObject:rule];
+  return index;
+}
+
+
+- (void)removeRulesAtIndexes:(NSIndexSet *)indices
+{
+  NSMutableArray *rules = [self.scheme.rules mutableCopy];
+  [rules removeObjectsAtIndexes:indices];
+  self.scheme.rules = rules;
+}
+
+
+- (NSUInteger)appendSelector:(NSString *)selector toRule:(QSchemeRule *)rule
+{
+  NSUInteger index = [rule.selectors count];
+  rule.selectors   = [rule.selectors arrayByAddingObject:selector];
+  return index;
+}
+
+
+- (void)
+  removeSelectorsAtIndexes:(NSIndexSet *)indices
+                  fromRule:(QSchemeRule *)rule
+{
+  NSMutableArray *selectors = [rule.selectors mutableCopy];
+  [selectors removeObjectsAtIndexes:indices];
+  rule.selectors = selectors;
+}
+
+
 - (IBAction)appendNewRule:(id)sender {
   NSTableView *table = self.rulesTable;
   if (table) {
     ++_midUpdate;
-    NSUInteger index    = [self.scheme.rules count];
+    NSUInteger index    = [self appendRule:[QSchemeRule new]];
     NSIndexSet *indices = [NSIndexSet indexSetWithIndex:index];
 
-    self.scheme.rules =
-      [self.scheme.rules arrayByAddingObject:[QSchemeRule new]];
-
     [table insertRowsAtIndexes:indices withAnimation:0];
     [table selectRowIndexes:indices byExtendingSelection:NO];
     [table scrollRowToVisible:index];
@@ -555,9 +913,7 @@ static NSArray *observedSchemeRulePaths()
 
     if ([indices count]) {
       ++_midUpdate;
-      NSMutableArray *rules = [self.scheme.rules mutableCopy];
-      [rules removeObjectsAtIndexes:indices];
-      self.scheme.rules = rules;
+      [self removeRulesAtIndexes:indices];
       [table removeRowsAtIndexes:indices
                    withAnimation:NSTableViewAnimationSlideLeft];
       --_midUpdate;
@@ -571,9 +927,8 @@ static NSArray *observedSchemeRulePaths()
   QSchemeRule *rule = self.selectorData.rule;
   if (rule && table) {
     [table beginUpdates];
-    NSUInteger index    = [rule.selectors count];
+    NSUInteger index    = [self appendSelector:@"scope" toRule:rule];
     NSIndexSet *indices = [NSIndexSet indexSetWithIndex:index];
-    rule.selectors      = [rule.selectors arrayByAddingObject:@"scope"];
 
     [table insertRowsAtIndexes:indices withAnimation:0];
     [table endUpdates];
@@ -593,10 +948,8 @@ static NSArray *observedSchemeRulePaths()
     NSIndexSet *indices = table.selectedRowIndexes;
 
     if ([indices count]) {
-      NSMutableArray *selectors = [rule.selectors mutableCopy];
-      [selectors removeObjectsAtIndexes:indices];
       [table beginUpdates];
-      rule.selectors = selectors;
+      [self removeSelectorsAtIndexes:indices fromRule:rule];
       [table removeRowsAtIndexes:indices
                    withAnimation:NSTableViewAnimationSlideLeft];
       [table endUpdates];
@@ -0,0 +1,64 @@
+/*===========================================================================
+  Copyright (c) 2014, Noel Cower.
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+  IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================*/
+
+/* QPreviewController.h - Noel Cower */
+
+#import <Cocoa/Cocoa.h>
+
+
+@class QScheme;
+@class QSchemeRule;
+@class QPreviewSource;
+
+
+/*
+Shows a sample source file styled with a scheme. The sample is tokenized
+once; each token's scope stack is resolved to the best-matching rule and an
+inverse index from rule to token ranges is kept, so changing a rule's colors
+or flags only restyles the ranges that rule applies to. Adding, removing, or
+reordering rules only scores the inserted and moved rules. Changes are
+coalesced and applied once per run loop pass.
+*/
+@interface QPreviewController : NSWindowController
+
+@property (strong, nonatomic) QScheme *scheme;
+@property (strong, readonly) QPreviewSource *source;
+
+- (id)initWithScheme:(QScheme *)scheme source:(QPreviewSource *)source;
+
+// Call when a rule's colors, flags, or selectors change.
+- (void)rule:(QSchemeRule *)rule didChangeKeyPath:(NSString *)keyPath;
+// Call when rules are added, removed, or reordered.
+- (void)rulesDidChange;
+// Call when one of the scheme's base colors changes.
+- (void)schemeColorsDidChange;
+
+// Applies pending changes now rather than on the next pass of the run loop.
+- (void)flushPendingChanges;
+
+@end
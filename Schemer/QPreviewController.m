@@ -0,0 +1,833 @@
+/*===========================================================================
+  Copyright (c) 2014, Noel Cower.
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+  IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================*/
+
+/* QPreviewController.m - Noel Cower */
+
+#import "QPreviewController.h"
+#import "QPreviewSource.h"
+#import "QScheme.h"
+#import "QSchemeRule.h"
+#import "QAppDelegate.h"
+#import "NSFilters.h"
+#import "aux.h"
+
+
+typedef struct {
+  uint64_t score;
+  NSUInteger rule; // Index into _rules or NSNotFound
+} QScopeMatch;
+
+
+enum {
+  SELECTOR_COMPONENTS = 0,
+  SELECTOR_EXCLUSIONS,
+  SELECTOR_KEY
+};
+
+
+#pragma mark Scope selectors
+
+static
+NSArray *
+selectorPath(NSString *string)
+{
+  NSCharacterSet *space = NSCharacterSet.whitespaceAndNewlineCharacterSet;
+  return [[string componentsSeparatedByCharactersInSet:space]
+          selectedBy:^BOOL(id obj) {
+            return [obj length] > 0;
+          }];
+}
+
+
+static
+NSString *
+firstSegment(NSString *scope)
+{
+  NSRange dot = [scope rangeOfString:@"."];
+  return dot.location == NSNotFound ? scope : [scope substringToIndex:dot.location];
+}
+
+
+// Compiles a selector such as "source.c string - string.quoted" into
+// @[components, exclusions, key], where key is the first segment of the last
+// component and is used to quickly reject scopes that can't match.
+static
+NSArray *
+compileSelector(NSString *selector)
+{
+  NSArray *parts = [selector componentsSeparatedByString:@" - "];
+  NSArray *components = selectorPath(parts[0]);
+
+  if ([components count] == 0) {
+    return nil;
+  }
+
+  NSArray *exclusions = @[];
+  if ([parts count] > 1) {
+    exclusions = [[parts subarrayWithRange:NSMakeRange(1, [parts count] - 1)]
+                  mappedTo:^id(id obj) {
+                    return selectorPath(obj);
+                  }];
+  }
+
+  return @[components, exclusions, firstSegment([components lastObject])];
+}
+
+
+static
+BOOL
+scopeHasPrefix(NSString *scope, NSString *prefix)
+{
+  NSUInteger length = [prefix length];
+  return
+       [scope hasPrefix:prefix]
+    && ([scope length] == length || [scope characterAtIndex:length] == '.');
+}
+
+
+static
+uint64_t
+segmentCount(NSString *scope)
+{
+  uint64_t count = 1;
+  NSUInteger length = [scope length];
+  for (NSUInteger index = 0; index < length; ++index) {
+    if ([scope characterAtIndex:index] == '.') {
+      ++count;
+    }
+  }
+  return count;
+}
+
+
+// Matches selector components against a scope stack, deepest first. Deeper
+// and more specific matches score higher. Returns 0 if there's no match.
+static
+uint64_t
+scorePath(NSArray *components, NSArray *stack)
+{
+  NSInteger component = (NSInteger)[components count] - 1;
+  uint64_t score = 0;
+
+  for (NSInteger depth = (NSInteger)[stack count] - 1;
+       depth >= 0 && component >= 0;
+       --depth) {
+    NSString *part = components[component];
+    if (scopeHasPrefix(stack[depth], part)) {
+      score += MIN(segmentCount(part), 15) << (4 * MIN(depth, 15));
+      --component;
+    }
+  }
+
+  return component < 0 ? score : 0;
+}
+
+
+static
+uint64_t
+scoreSelector(NSArray *compiled, NSArray *stack, NSSet *stackKeys)
+{
+  if (![stackKeys containsObject:compiled[SELECTOR_KEY]]) {
+    return 0;
+  }
+
+  uint64_t score = scorePath(compiled[SELECTOR_COMPONENTS], stack);
+  if (score) {
+    for (NSArray *exclusion in compiled[SELECTOR_EXCLUSIONS]) {
+      if ([exclusion count] && scorePath(exclusion, stack)) {
+        return 0;
+      }
+    }
+  }
+
+  return score;
+}
+
+
+@implementation QPreviewController {
+  NSTextView *_textView;
+  NSArray *_rules;
+  NSArray *_scopeKeys;             // <NSSet>, first segments per scope stack
+  NSMutableData *_scopeMatches;    // QScopeMatch per scope
+  NSMapTable *_ruleTokens;         // QSchemeRule -> NSMutableIndexSet
+  NSMapTable *_compiledSelectors;  // QSchemeRule -> NSArray
+  NSMutableDictionary *_fonts;     // @(flags & (bold | italic)) -> NSFont
+  NSMutableIndexSet *_dirtyTokens;
+  NSHashTable *_rematchRules;
+  QSchemeRule *_styledRootRule;    // Rule the text between tokens is styled by
+  BOOL _needsRematch;
+  BOOL _rulesChanged;
+  BOOL _needsFullRestyle;
+  BOOL _flushScheduled;
+}
+
+
+- (void)dealloc
+{
+  [NSObject cancelPreviousPerformRequestsWithTarget:self];
+  [[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
+
+- (id)initWithScheme:(QScheme *)scheme source:(QPreviewSource *)source
+{
+  NSUInteger style =
+      NSTitledWindowMask
+    | NSClosableWindowMask
+    | NSMiniaturizableWindowMask
+    | NSResizableWindowMask;
+
+  NSWindow *window =
+    [[NSWindow alloc] initWithContentRect:NSMakeRect(0.0, 0.0, 640.0, 720.0)
+                                styleMask:style
+                                  backing:NSBackingStoreBuffered
+                                    defer:YES];
+
+  if ((self = [super initWithWindow:window])) {
+    NSPointerFunctionsOptions identity =
+      NSPointerFunctionsObjectPointerPersonality | NSPointerFunctionsStrongMemory;
+
+    _source = source;
+    _scopeKeys = [source.scopes mappedTo:^id(NSArray *stack) {
+      return [NSSet setWithArray:[stack mappedTo:^id(id obj) {
+        return firstSegment(obj);
+      }]];
+    }];
+    _scopeMatches = [NSMutableData dataWithLength:
+                     sizeof(QScopeMatch) * [source.scopes count]];
+    _ruleTokens = [[NSMapTable alloc] initWithKeyOptions:identity
+                                            valueOptions:NSPointerFunctionsStrongMemory
+                                                capacity:64];
+    _compiledSelectors = [[NSMapTable alloc] initWithKeyOptions:identity
+                                                   valueOptions:NSPointerFunctionsStrongMemory
+                                                       capacity:64];
+    _rematchRules = [[NSHashTable alloc] initWithOptions:identity capacity:4];
+    _dirtyTokens = [NSMutableIndexSet new];
+    _fonts = [NSMutableDictionary dictionaryWithCapacity:4];
+
+    [self buildTextViewInWindow:window];
+    [window center];
+
+    [[NSNotificationCenter defaultCenter]
+     addObserver:self selector:@selector(userFontChanged:)
+     name:QFontChangeNotification
+     object:nil];
+
+    self.scheme = scheme;
+    [self flushPendingChanges];
+  }
+
+  return self;
+}
+
+
+- (void)buildTextViewInWindow:(NSWindow *)window
+{
+  NSView *content = window.contentView;
+  NSScrollView *scroll = [[NSScrollView alloc] initWithFrame:content.bounds];
+  scroll.autoresizingMask = NSViewWidthSizable | NSViewHeightSizable;
+  scroll.hasVerticalScroller = YES;
+  scroll.hasHorizontalScroller = YES;
+  scroll.borderType = NSNoBorder;
+
+  NSTextView *text =
+    [[NSTextView alloc] initWithFrame:scroll.contentView.bounds];
+  text.editable = NO;
+  text.selectable = YES;
+  text.richText = YES;
+  text.horizontallyResizable = YES;
+  text.autoresizingMask = NSViewWidthSizable | NSViewHeightSizable;
+  text.maxSize = NSMakeSize(CGFLOAT_MAX, CGFLOAT_MAX);
+  text.textContainer.widthTracksTextView = NO;
+  text.textContainer.containerSize = NSMakeSize(CGFLOAT_MAX, CGFLOAT_MAX);
+  text.layoutManager.allowsNonContiguousLayout = YES;
+
+  [text.textStorage replaceCharactersInRange:NSMakeRange(0, 0)
+                                  withString:_source.text];
+
+  scroll.documentView = text;
+  window.contentView = scroll;
+  _textView = text;
+}
+
+
+- (NSString *)windowTitleForDocumentDisplayName:(NSString *)displayName
+{
+  return [NSString stringWithFormat:@"%@ (Preview)", displayName];
+}
+
+
+- (void)userFontChanged:(NSNotification *)note
+{
+  [_fonts removeAllObjects];
+  _needsFullRestyle = YES;
+  [self setNeedsFlush];
+}
+
+
+#pragma mark Change notifications
+
+- (void)setScheme:(QScheme *)scheme
+{
+  _scheme = scheme;
+  [_compiledSelectors removeAllObjects];
+  _needsRematch = YES;
+  [self schemeColorsDidChange];
+}
+
+
+- (void)rule:(QSchemeRule *)rule didChangeKeyPath:(NSString *)keyPath
+{
+  if ([keyPath isEqualToString:@"selectors"]) {
+    [_compiledSelectors removeObjectForKey:rule];
+    [_rematchRules addObject:rule];
+  } else if ([keyPath isEqualToString:@"name"]) {
+    return;
+  } else if (rule == _styledRootRule) {
+    // Styles all the text between tokens as well as its own tokens.
+    _needsFullRestyle = YES;
+  } else {
+    NSIndexSet *tokens = [_ruleTokens objectForKey:rule];
+    if (tokens) {
+      [_dirtyTokens addIndexes:tokens];
+    }
+  }
+
+  [self setNeedsFlush];
+}
+
+
+- (void)rulesDidChange
+{
+  _rulesChanged = YES;
+  [self setNeedsFlush];
+}
+
+
+- (void)schemeColorsDidChange
+{
+  _needsFullRestyle = YES;
+  [self setNeedsFlush];
+}
+
+
+- (void)setNeedsFlush
+{
+  if (_flushScheduled) {
+    return;
+  }
+
+  // Coalesce everything that happens during this pass of the run loop (e.g.,
+  // a burst of color well actions during a drag) into a single restyle.
+  _flushScheduled = YES;
+  [self performSelector:@selector(flushPendingChanges)
+             withObject:nil
+             afterDelay:0.0
+                inModes:@[NSRunLoopCommonModes]];
+}
+
+
+- (void)flushPendingChanges
+{
+  if (_flushScheduled) {
+    [NSObject cancelPreviousPerformRequestsWithTarget:self
+                                             selector:@selector(flushPendingChanges)
+                                               object:nil];
+    _flushScheduled = NO;
+  }
+
+  if (_needsRematch) {
+    [self rematchAllRules];
+    _needsFullRestyle = YES;
+  } else {
+    if (_rulesChanged) {
+      [self updateRules];
+    }
+
+    for (QSchemeRule *rule in _rematchRules) {
+      [self rematchRule:rule];
+    }
+  }
+
+  [_rematchRules removeAllObjects];
+  _needsRematch = NO;
+  _rulesChanged = NO;
+
+  if ([self ruleForScope:_source.rootScope] != _styledRootRule) {
+    _needsFullRestyle = YES;
+  }
+
+  if (_needsFullRestyle) {
+    [self restyleAll];
+  } else if ([_dirtyTokens count]) {
+    [self restyleTokens:_dirtyTokens];
+  }
+
+  [_dirtyTokens removeAllIndexes];
+  _needsFullRestyle = NO;
+}
+
+
+#pragma mark Matching
+
+- (NSArray *)compiledSelectorsForRule:(QSchemeRule *)rule
+{
+  NSArray *compiled = [_compiledSelectors objectForKey:rule];
+  if (!compiled) {
+    compiled = [[rule.selectors mappedTo:^id(id obj) {
+      return compileSelector(obj) ?: [NSNull null];
+    }] rejectedBy:^BOOL(id obj) {
+      return obj == [NSNull null];
+    }];
+    [_compiledSelectors setObject:compiled forKey:rule];
+  }
+  return compiled;
+}
+
+
+- (uint64_t)scoreRule:(QSchemeRule *)rule forScope:(NSUInteger)scope
+{
+  NSArray *stack = _source.scopes[scope];
+  NSSet *keys = _scopeKeys[scope];
+  uint64_t best = 0;
+
+  for (NSArray *compiled in [self compiledSelectorsForRule:rule]) {
+    best = MAX(best, scoreSelector(compiled, stack, keys));
+  }
+
+  return best;
+}
+
+
+- (void)rematchScope:(NSUInteger)scope
+{
+  QScopeMatch *match = (QScopeMatch *)_scopeMatches.mutableBytes + scope;
+  match->score = 0;
+  match->rule = NSNotFound;
+
+  NSUInteger index = 0;
+  for (QSchemeRule *rule in _rules) {
+    uint64_t score = [self scoreRule:rule forScope:scope];
+    // Later rules win ties, same as in the editor.
+    if (score && score >= match->score) {
+      match->score = score;
+      match->rule = index;
+    }
+    ++index;
+  }
+}
+
+
+- (void)rematchAllRules
+{
+  NSArray *rules = [self.scheme.rules copy] ?: @[];
+  NSMapTable *compiled = [_compiledSelectors copy];
+
+  // Drop compiled selectors for rules that no longer exist.
+  [_compiledSelectors removeAllObjects];
+  for (QSchemeRule *rule in rules) {
+    NSArray *selectors = [compiled objectForKey:rule];
+    if (selectors) {
+      [_compiledSelectors setObject:selectors forKey:rule];
+    }
+  }
+
+  _rules = rules;
+
+  NSUInteger scopeCount = [_source.scopes count];
+  QScopeMatch *matches = (QScopeMatch *)_scopeMatches.mutableBytes;
+  for (NSUInteger scope = 0; scope < scopeCount; ++scope) {
+    matches[scope].score = 0;
+    matches[scope].rule = NSNotFound;
+  }
+
+  NSUInteger index = 0;
+  for (QSchemeRule *rule in rules) {
+    for (NSUInteger scope = 0; scope < scopeCount; ++scope) {
+      uint64_t score = [self scoreRule:rule forScope:scope];
+      if (score && score >= matches[scope].score) {
+        matches[scope].score = score;
+        matches[scope].rule = index;
+      }
+    }
+    ++index;
+  }
+
+  [self rebuildRuleTokens];
+}
+
+
+// Brings matches up to date after rules were added, removed, or reordered.
+// Only rules that were inserted or moved are scored against every scope, and
+// only scopes whose best match was removed or moved are scored against every
+// rule. Rules that kept their relative order keep their matches.
+- (void)updateRules
+{
+  NSArray *oldRules = _rules;
+  NSArray *rules = [self.scheme.rules copy] ?: @[];
+  NSUInteger oldCount = [oldRules count];
+  NSUInteger count = [rules count];
+
+  NSMapTable *oldIndices = NSCreateMapTable(NSNonOwnedPointerMapKeyCallBacks,
+                                            NSIntegerMapValueCallBacks,
+                                            oldCount);
+  NSUInteger *oldToNew = malloc(sizeof(NSUInteger) * MAX(oldCount, 1));
+  NSUInteger *sequence = malloc(sizeof(NSUInteger) * MAX(count, 1));
+  NSUInteger *positions = malloc(sizeof(NSUInteger) * MAX(count, 1));
+  BOOL *inOrder = calloc(MAX(count, 1), sizeof(BOOL));
+  BOOL *candidates = calloc(MAX(count, 1), sizeof(BOOL));
+  NSUInteger survivors = 0;
+
+  // Indices are stored off by one since NULL means not found.
+  for (NSUInteger index = 0; index < oldCount; ++index) {
+    oldToNew[index] = NSNotFound;
+    NSMapInsert(oldIndices,
+                (__bridge const void *)oldRules[index],
+                (const void *)(index + 1));
+  }
+
+  for (NSUInteger index = 0; index < count; ++index) {
+    NSUInteger old =
+      (NSUInteger)NSMapGet(oldIndices, (__bridge const void *)rules[index]);
+    if (old) {
+      oldToNew[old - 1] = index;
+      sequence[survivors] = old - 1;
+      positions[survivors] = index;
+      ++survivors;
+    } else {
+      candidates[index] = YES;
+    }
+  }
+
+  NSFreeMapTable(oldIndices);
+
+  for (NSUInteger index = 0; index < oldCount; ++index) {
+    if (oldToNew[index] == NSNotFound) {
+      [_compiledSelectors removeObjectForKey:oldRules[index]];
+      [_ruleTokens removeObjectForKey:oldRules[index]];
+    }
+  }
+
+  // A rule that moved relative to the others may now win or lose ties, so it's
+  // treated as removed and reinserted.
+  markLongestIncreasing(sequence, survivors, inOrder);
+  for (NSUInteger survivor = 0; survivor < survivors; ++survivor) {
+    if (!inOrder[survivor]) {
+      oldToNew[sequence[survivor]] = NSNotFound;
+      candidates[positions[survivor]] = YES;
+    }
+  }
+
+  _rules = rules;
+
+  NSUInteger scopeCount = [_source.scopes count];
+  QScopeMatch *matches = (QScopeMatch *)_scopeMatches.mutableBytes;
+  NSUInteger *oldWinners = malloc(sizeof(NSUInteger) * MAX(scopeCount, 1));
+
+  for (NSUInteger scope = 0; scope < scopeCount; ++scope) {
+    QScopeMatch *match = &matches[scope];
+    oldWinners[scope] = match->rule;
+
+    if (match->rule == NSNotFound) {
+      continue;
+    } else if (oldToNew[match->rule] == NSNotFound) {
+      [self rematchScope:scope];
+    } else {
+      match->rule = oldToNew[match->rule];
+    }
+  }
+
+  for (NSUInteger index = 0; index < count; ++index) {
+    if (!candidates[index]) {
+      continue;
+    }
+
+    QSchemeRule *rule = rules[index];
+    for (NSUInteger scope = 0; scope < scopeCount; ++scope) {
+      QScopeMatch *match = &matches[scope];
+      uint64_t score = [self scoreRule:rule forScope:scope];
+      if (   score
+          && (   score > match->score
+              || (score == match->score && index > match->rule)
+              || match->rule == NSNotFound)) {
+        match->score = score;
+        match->rule = index;
+      }
+    }
+  }
+
+  // Move tokens whose scope changed hands between the rules' token sets.
+  BOOL *changed = calloc(MAX(scopeCount, 1), sizeof(BOOL));
+  BOOL anyChanged = NO;
+  for (NSUInteger scope = 0; scope < scopeCount; ++scope) {
+    NSUInteger oldIndex = oldWinners[scope];
+    NSUInteger newIndex = matches[scope].rule;
+    QSchemeRule *oldRule = oldIndex == NSNotFound ? nil : oldRules[oldIndex];
+    QSchemeRule *newRule = newIndex == NSNotFound ? nil : rules[newIndex];
+    changed[scope] = oldRule != newRule;
+    anyChanged = anyChanged || changed[scope];
+  }
+
+  const QPreviewToken *tokens = _source.tokens;
+  NSUInteger tokenCount = anyChanged ? _source.tokenCount : 0;
+  for (NSUInteger token = 0; token < tokenCount; ++token) {
+    NSUInteger scope = tokens[token].scope;
+    if (!changed[scope]) {
+      continue;
+    }
+
+    if (oldWinners[scope] != NSNotFound) {
+      QSchemeRule *oldRule = oldRules[oldWinners[scope]];
+      [[_ruleTokens objectForKey:oldRule] removeIndex:token];
+    }
+
+    if (matches[scope].rule != NSNotFound) {
+      QSchemeRule *newRule = rules[matches[scope].rule];
+      NSMutableIndexSet *indices = [_ruleTokens objectForKey:newRule];
+      if (!indices) {
+        indices = [NSMutableIndexSet new];
+        [_ruleTokens setObject:indices forKey:newRule];
+      }
+      [indices addIndex:token];
+    }
+
+    [_dirtyTokens addIndex:token];
+  }
+
+  free(changed);
+  free(oldWinners);
+  free(candidates);
+  free(inOrder);
+  free(positions);
+  free(sequence);
+  free(oldToNew);
+}
+
+
+// Re-evaluates a single rule whose selectors changed. Only scopes whose best
+// match changes are restyled.
+- (void)rematchRule:(QSchemeRule *)rule
+{
+  NSUInteger ruleIndex = [_rules indexOfObjectIdenticalTo:rule];
+  if (ruleIndex == NSNotFound) {
+    return;
+  }
+
+  NSUInteger scopeCount = [_source.scopes count];
+  QScopeMatch *matches = (QScopeMatch *)_scopeMatches.mutableBytes;
+  NSMutableIndexSet *changedScopes = [NSMutableIndexSet new];
+
+  for (NSUInteger scope = 0; scope < scopeCount; ++scope) {
+    QScopeMatch *match = &matches[scope];
+    uint64_t score = [self scoreRule:rule forScope:scope];
+
+    if (match->rule == ruleIndex) {
+      if (score >= match->score) {
+        match->score = score;
+      } else {
+        [self rematchScope:scope];
+        if (match->rule != ruleIndex) {
+          [changedScopes addIndex:scope];
+        }
+      }
+    } else if (   score
+               && (   score > match->score
+                   || (score == match->score && ruleIndex > match->rule)
+                   || match->rule == NSNotFound)) {
+      match->score = score;
+      match->rule = ruleIndex;
+      [changedScopes addIndex:scope];
+    }
+  }
+
+  if ([changedScopes count] == 0) {
+    return;
+  }
+
+  [self rebuildRuleTokens];
+
+  const QPreviewToken *tokens = _source.tokens;
+  NSUInteger tokenCount = _source.tokenCount;
+  for (NSUInteger token = 0; token < tokenCount; ++token) {
+    if ([changedScopes containsIndex:tokens[token].scope]) {
+      [_dirtyTokens addIndex:token];
+    }
+  }
+}
+
+
+- (void)rebuildRuleTokens
+{
+  [_ruleTokens removeAllObjects];
+
+  const QScopeMatch *matches = (const QScopeMatch *)_scopeMatches.bytes;
+  const QPreviewToken *tokens = _source.tokens;
+  NSUInteger tokenCount = _source.tokenCount;
+
+  for (NSUInteger token = 0; token < tokenCount; ++token) {
+    NSUInteger ruleIndex = matches[tokens[token].scope].rule;
+    if (ruleIndex == NSNotFound) {
+      continue;
+    }
+
+    QSchemeRule *rule = _rules[ruleIndex];
+    NSMutableIndexSet *indices = [_ruleTokens objectForKey:rule];
+    if (!indices) {
+      indices = [NSMutableIndexSet new];
+      [_ruleTokens setObject:indices forKey:rule];
+    }
+    [indices addIndex:token];
+  }
+}
+
+
+- (QSchemeRule *)ruleForScope:(NSUInteger)scope
+{
+  const QScopeMatch *matches = (const QScopeMatch *)_scopeMatches.bytes;
+  NSUInteger ruleIndex = matches[scope].rule;
+  return ruleIndex == NSNotFound ? nil : _rules[ruleIndex];
+}
+
+
+- (QSchemeRule *)ruleForToken:(NSUInteger)token
+{
+  return [self ruleForScope:_source.tokens[token].scope];
+}
+
+
+#pragma mark Styling
+
+- (NSFont *)fontForFlags:(uint32_t)flags
+{
+  NSNumber *key = @(flags & (QBoldFlag | QItalicFlag));
+  NSFont *font = _fonts[key];
+
+  if (!font) {
+    NSFontManager *manager = [NSFontManager sharedFontManager];
+    font = [NSFont userFixedPitchFontOfSize:0.0];
+
+    if (flags & QBoldFlag) {
+      font = [manager convertFont:font toHaveTrait:NSBoldFontMask];
+    }
+
+    if (flags & QItalicFlag) {
+      font = [manager convertFont:font toHaveTrait:NSItalicFontMask];
+    }
+
+    _fonts[key] = font;
+  }
+
+  return font;
+}
+
+
+- (NSDictionary *)attributesForRule:(QSchemeRule *)rule
+{
+  QScheme *scheme = self.scheme;
+  uint32_t flags = rule ? rule.flags.unsignedIntValue : QNoFlags;
+  NSMutableDictionary *attrs = [NSMutableDictionary dictionaryWithCapacity:4];
+
+  attrs[NSFontAttributeName] = [self fontForFlags:flags];
+  attrs[NSForegroundColorAttributeName] =
+    rule && colorIsDefined(rule.foreground)
+    ? rule.foreground
+    : scheme.foregroundColor;
+
+  if (rule && colorIsDefined(rule.background)) {
+    attrs[NSBackgroundColorAttributeName] =
+      blendColors(scheme.backgroundColor, rule.background);
+  }
+
+  if (flags & QUnderlineFlag) {
+    attrs[NSUnderlineStyleAttributeName] = @(NSUnderlineStyleSingle);
+  }
+
+  return attrs;
+}
+
+
+- (void)applyTokens:(NSIndexSet *)tokenIndices
+          toStorage:(NSTextStorage *)storage
+{
+  const QPreviewToken *tokens = _source.tokens;
+  NSMapTable *ruleAttrs =
+    [NSMapTable mapTableWithKeyOptions:NSPointerFunctionsObjectPointerPersonality
+                          valueOptions:NSPointerFunctionsStrongMemory];
+  NSDictionary *baseAttrs = [self attributesForRule:_styledRootRule];
+
+  [tokenIndices enumerateIndexesUsingBlock:^(NSUInteger token, BOOL *stop) {
+    QSchemeRule *rule = [self ruleForToken:token];
+    NSDictionary *attrs = nil;
+
+    if (rule) {
+      attrs = [ruleAttrs objectForKey:rule];
+      if (!attrs) {
+        attrs = [self attributesForRule:rule];
+        [ruleAttrs setObject:attrs forKey:rule];
+      }
+    } else {
+      attrs = baseAttrs;
+    }
+
+    [storage setAttributes:attrs range:tokens[token].range];
+  }];
+}
+
+
+- (void)restyleTokens:(NSIndexSet *)tokens
+{
+  NSTextStorage *storage = _textView.textStorage;
+  [storage beginEditing];
+  [self applyTokens:tokens toStorage:storage];
+  [storage endEditing];
+}
+
+
+- (void)restyleAll
+{
+  QScheme *scheme = self.scheme;
+  NSTextStorage *storage = _textView.textStorage;
+
+  _textView.backgroundColor = scheme.backgroundColor;
+  _textView.insertionPointColor = scheme.caretColor;
+  _textView.selectedTextAttributes = @{
+    NSBackgroundColorAttributeName: scheme.selectionColor
+  };
+
+  _styledRootRule = [self ruleForScope:_source.rootScope];
+
+  [storage beginEditing];
+  [storage setAttributes:[self attributesForRule:_styledRootRule]
+                   range:NSMakeRange(0, storage.length)];
+  [self applyTokens:[NSIndexSet indexSetWithIndexesInRange:
+                     NSMakeRange(0, _source.tokenCount)]
+          toStorage:storage];
+  [storage endEditing];
+}
+
+@end
@@ -0,0 +1,58 @@
+/*===========================================================================
+  Copyright (c) 2014, Noel Cower.
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+  IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================*/
+
+/* QPreviewSource.h - Noel Cower */
+
+#import <Foundation/Foundation.h>
+
+
+typedef struct {
+  NSRange range;
+  NSUInteger scope; // Index into QPreviewSource.scopes
+} QPreviewToken;
+
+
+/*
+Sample source text for the preview window, tokenized once into TextMate-style
+scope stacks. Only ranges with a scope beyond the root `source.c` scope get a
+token; everything else is styled as the root scope on its own, which has a
+stack of its own at rootScope.
+*/
+@interface QPreviewSource : NSObject
+
+@property (copy, readonly) NSString *text;
+@property (copy, readonly) NSArray *scopes; // <NSArray <NSString>>, root first
+@property (readonly) NSUInteger rootScope;  // Index of the root-only stack
+@property (readonly) NSUInteger tokenCount;
+@property (readonly) const QPreviewToken *tokens;
+
++ (QPreviewSource *)bundledSample;
+
+- (id)initWithCSource:(NSString *)text;
+
+@end
@@ -0,0 +1,338 @@
+/*===========================================================================
+  Copyright (c) 2014, Noel Cower.
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+  IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================*/
+
+/* QPreviewSource.m - Noel Cower */
+
+#import "QPreviewSource.h"
+
+
+static NSString *const QPreviewRootScope = @"source.c";
+
+
+static
+NSSet *
+keywordsForKind(NSString *kind)
+{
+  static NSDictionary *keywords = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    keywords = @{
+      @"control": [NSSet setWithArray:@[
+        @"if", @"else", @"for", @"while", @"do", @"switch", @"case",
+        @"default", @"break", @"continue", @"return", @"goto"
+      ]],
+      @"type": [NSSet setWithArray:@[
+        @"void", @"char", @"short", @"int", @"long", @"float", @"double",
+        @"signed", @"unsigned", @"struct", @"union", @"enum", @"typedef",
+        @"size_t", @"bool", @"BOOL", @"id"
+      ]],
+      @"modifier": [NSSet setWithArray:@[
+        @"const", @"static", @"extern", @"inline", @"volatile", @"register"
+      ]],
+      @"constant": [NSSet setWithArray:@[
+        @"NULL", @"true", @"false", @"YES", @"NO", @"nil",
+        @"EXIT_SUCCESS", @"EXIT_FAILURE"
+      ]]
+    };
+  });
+  return keywords[kind];
+}
+
+
+static
+BOOL
+isIdentifierStart(unichar ch)
+{
+  return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_';
+}
+
+
+static
+BOOL
+isIdentifierChar(unichar ch)
+{
+  return isIdentifierStart(ch) || (ch >= '0' && ch <= '9');
+}
+
+
+static
+BOOL
+isOperatorChar(unichar ch)
+{
+  return ch && strchr("+-*/%=<>!&|^~?:", (int)ch) != NULL;
+}
+
+
+@implementation QPreviewSource {
+  NSMutableData *_tokens;
+  NSMutableArray *_scopes;
+  NSMutableDictionary *_scopeIndices;
+}
+
+
++ (QPreviewSource *)bundledSample
+{
+  static QPreviewSource *sample = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    NSURL *url = [[NSBundle mainBundle] URLForResource:@"PreviewSample"
+                                         withExtension:@"txt"];
+    NSString *text = url
+      ? [NSString stringWithContentsOfURL:url
+                                 encoding:NSUTF8StringEncoding
+                                    error:NULL]
+      : nil;
+    sample = [[QPreviewSource alloc] initWithCSource:text ?: @""];
+  });
+  return sample;
+}
+
+
+- (id)initWithCSource:(NSString *)text
+{
+  if ((self = [super init])) {
+    _text = [text copy];
+    _tokens = [NSMutableData data];
+    _scopes = [NSMutableArray array];
+    _scopeIndices = [NSMutableDictionary dictionary];
+
+    // Never used by a token, since tokens are only made for scopes below the
+    // root, but it's what the text between tokens matches.
+    _rootScope = [_scopes count];
+    [_scopes addObject:@[QPreviewRootScope]];
+
+    [self tokenize];
+  }
+  return self;
+}
+
+
+- (NSArray *)scopes
+{
+  return _scopes;
+}
+
+
+- (NSUInteger)tokenCount
+{
+  return _tokens.length / sizeof(QPreviewToken);
+}
+
+
+- (const QPreviewToken *)tokens
+{
+  return (const QPreviewToken *)_tokens.bytes;
+}
+
+
+- (void)addToken:(NSRange)range scope:(NSString *)scope
+{
+  NSNumber *index = _scopeIndices[scope];
+
+  if (!index) {
+    NSArray *stack = [@[QPreviewRootScope] arrayByAddingObjectsFromArray:
+                      [scope componentsSeparatedByString:@" "]];
+    index = @([_scopes count]);
+    [_scopes addObject:stack];
+    _scopeIndices[scope] = index;
+  }
+
+  QPreviewToken token = { range, index.unsignedIntegerValue };
+  [_tokens appendBytes:&token length:sizeof(token)];
+}
+
+
+// A small hand-written C lexer. It is nowhere near a real grammar, but it
+// produces the scopes that themes most commonly target.
+- (void)tokenize
+{
+  NSUInteger length = [_text length];
+  unichar *chars = malloc(sizeof(unichar) * (length + 1));
+  [_text getCharacters:chars range:NSMakeRange(0, length)];
+  chars[length] = 0;
+
+  NSSet *controls = keywordsForKind(@"control");
+  NSSet *types = keywordsForKind(@"type");
+  NSSet *modifiers = keywordsForKind(@"modifier");
+  NSSet *constants = keywordsForKind(@"constant");
+
+  NSUInteger index = 0;
+  NSInteger braceDepth = 0;
+  BOOL lineStart = YES;
+  BOOL afterType = NO;
+
+  while (index < length) {
+    unichar ch = chars[index];
+    unichar next = chars[index + 1];
+    NSUInteger start = index;
+
+    if (ch == '\n') {
+      lineStart = YES;
+      ++index;
+      continue;
+    } else if (ch == ' ' || ch == '\t' || ch == '\r') {
+      ++index;
+      continue;
+    }
+
+    BOOL wasLineStart = lineStart;
+    lineStart = NO;
+
+    if (ch == '/' && next == '/') {
+      while (index < length && chars[index] != '\n') {
+        ++index;
+      }
+      [self addToken:NSMakeRange(start, index - start)
+               scope:@"comment.line.double-slash.c"];
+    } else if (ch == '/' && next == '*') {
+      index += 2;
+      while (index < length && !(chars[index] == '*' && chars[index + 1] == '/')) {
+        ++index;
+      }
+      index = MIN(index + 2, length);
+      [self addToken:NSMakeRange(start, index - start) scope:@"comment.block.c"];
+    } else if (ch == '"' || ch == '\'') {
+      for (++index; index < length && chars[index] != ch; ++index) {
+        if (chars[index] == '\\') {
+          ++index;
+        }
+      }
+      index = MIN(index + 1, length);
+      [self addToken:NSMakeRange(start, index - start)
+               scope:ch == '"' ? @"string.quoted.double.c"
+                               : @"string.quoted.single.c"];
+    } else if (ch == '#' && wasLineStart) {
+      for (++index; index < length && isIdentifierChar(chars[index]); ++index) {
+      }
+      NSString *directive =
+        [_text substringWithRange:NSMakeRange(start + 1, index - start - 1)];
+      [self addToken:NSMakeRange(start, index - start)
+               scope:@"meta.preprocessor.c keyword.control.directive.c"];
+
+      if ([directive isEqualToString:@"include"]) {
+        while (index < length && (chars[index] == ' ' || chars[index] == '\t')) {
+          ++index;
+        }
+        if (index < length && chars[index] == '<') {
+          NSUInteger open = index;
+          while (index < length && chars[index] != '>' && chars[index] != '\n') {
+            ++index;
+          }
+          index = MIN(index + 1, length);
+          [self addToken:NSMakeRange(open, index - open)
+                   scope:@"meta.preprocessor.c string.quoted.other.lt-gt.include.c"];
+        }
+      } else if ([directive isEqualToString:@"define"]) {
+        while (index < length && (chars[index] == ' ' || chars[index] == '\t')) {
+          ++index;
+        }
+        NSUInteger name = index;
+        while (index < length && isIdentifierChar(chars[index])) {
+          ++index;
+        }
+        if (index > name) {
+          [self addToken:NSMakeRange(name, index - name)
+                   scope:@"meta.preprocessor.macro.c entity.name.function.preprocessor.c"];
+        }
+      }
+    } else if (ch >= '0' && ch <= '9') {
+      while (index < length && (isIdentifierChar(chars[index]) || chars[index] == '.')) {
+        ++index;
+      }
+      [self addToken:NSMakeRange(start, index - start) scope:@"constant.numeric.c"];
+    } else if (isIdentifierStart(ch)) {
+      while (index < length && isIdentifierChar(chars[index])) {
+        ++index;
+      }
+
+      NSRange range = NSMakeRange(start, index - start);
+      NSString *word = [_text substringWithRange:range];
+      NSUInteger lookahead = index;
+      while (lookahead < length && (chars[lookahead] == ' ' || chars[lookahead] == '\t')) {
+        ++lookahead;
+      }
+
+      BOOL isType = NO;
+      if ([controls containsObject:word]) {
+        [self addToken:range scope:@"keyword.control.c"];
+      } else if ([types containsObject:word] || [word hasSuffix:@"_t"]) {
+        [self addToken:range scope:@"storage.type.c"];
+        isType = YES;
+      } else if ([modifiers containsObject:word]) {
+        [self addToken:range scope:@"storage.modifier.c"];
+        isType = afterType;
+      } else if ([constants containsObject:word]) {
+        [self addToken:range scope:@"constant.language.c"];
+      } else if (lookahead < length && chars[lookahead] == '(') {
+        if (braceDepth == 0 && (afterType || wasLineStart)) {
+          [self addToken:range scope:@"meta.function.c entity.name.function.c"];
+        } else {
+          [self addToken:range scope:@"meta.function-call.c support.function.c"];
+        }
+      } else if ([word isEqualToString:[word uppercaseString]]) {
+        [self addToken:range scope:@"constant.other.c"];
+      } else {
+        [self addToken:range scope:@"variable.other.c"];
+      }
+
+      afterType = isType;
+      continue;
+    } else if (isOperatorChar(ch)) {
+      while (index < length && isOperatorChar(chars[index])) {
+        ++index;
+      }
+      [self addToken:NSMakeRange(start, index - start) scope:@"keyword.operator.c"];
+    } else {
+      switch (ch) {
+      case ';':
+        [self addToken:NSMakeRange(start, 1) scope:@"punctuation.terminator.c"];
+        break;
+      case ',':
+        [self addToken:NSMakeRange(start, 1) scope:@"punctuation.separator.c"];
+        break;
+      case '{':
+        ++braceDepth;
+        [self addToken:NSMakeRange(start, 1) scope:@"punctuation.section.block.begin.c"];
+        break;
+      case '}':
+        --braceDepth;
+        [self addToken:NSMakeRange(start, 1) scope:@"punctuation.section.block.end.c"];
+        break;
+      default:
+        break;
+      }
+      ++index;
+    }
+
+    afterType = NO;
+  }
+
+  free(chars);
+}
+
+@end
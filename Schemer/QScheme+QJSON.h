@@ -0,0 +1,59 @@
+/*===========================================================================
+  Copyright (c) 2014, Noel Cower.
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+  IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================*/
+
+/* QScheme+QJSON.h - Noel Cower */
+
+#import "QScheme.h"
+
+
+extern NSString *const QInvalidJSONErrorDomain;
+
+
+/*
+Reads and writes Sublime Text's .sublime-color-scheme JSON format. `globals`
+map onto the scheme's base colors and `rules` onto QSchemeRules.
+
+Reading is done directly off of the given data's bytes (map it with
+NSDataReadingMappedIfSafe for large files) without building an intermediate
+NSDictionary tree. Comments and trailing commas are accepted, as they are by
+Sublime. Colors may be #RGB, #RGBA, #RRGGBB, #RRGGBBAA, rgb(), rgba(), hsl(),
+hsla(), CSS color names, var() references, or color() with the alpha()/a(),
+saturation()/s(), lightness()/l(), blend(), and blenda() adjusters. Variables
+may be declared anywhere in the file. Any other color value fails the read
+with error code 3, listing the values in the error's "values" key.
+
+Writing appends to a single NSMutableData and uses the same color
+quantization and omission rules as -toPropertyList, so schemes round-trip
+between the two formats without loss.
+*/
+@interface QScheme (QJSON)
+
+- (id)initWithJSONData:(NSData *)data error:(NSError *__autoreleasing *)outError;
+- (NSData *)toJSONDataWithName:(NSString *)name;
+
+@end
@@ -0,0 +1,1953 @@
+/*===========================================================================
+  Copyright (c) 2014, Noel Cower.
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+  IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================*/
+
+/* QScheme+QJSON.m - Noel Cower */
+
+#import "QScheme+QJSON.h"
+#import "QSchemeRule.h"
+#import "NSColor+QHexColor.h"
+#import "aux.h"
+
+
+NSString *const QInvalidJSONErrorDomain = @"QInvalidJSON";
+
+
+typedef struct {
+  const uint8_t *bytes;
+  NSUInteger length;
+} QJSONSpan;
+
+
+typedef struct {
+  const uint8_t *start;
+  const uint8_t *cursor;
+  const uint8_t *end;
+  BOOL failed;
+  // Holds the unescaped contents of the last string read if it contained
+  // escapes. Spans returned by readString() are only valid until the next
+  // read. Not retained, so whoever sets up the reader has to keep it alive.
+  __unsafe_unretained NSMutableData *scratch;
+} QJSONReader;
+
+
+typedef struct {
+  const char *jsonKey;
+  __unsafe_unretained NSString *propertyKey;
+  BOOL opaque;
+} QJSONGlobalKey;
+
+
+static const QJSONGlobalKey g_globalKeys[] = {
+  { "foreground",                @"foregroundColor",        YES },
+  { "background",                @"backgroundColor",        YES },
+  { "line_highlight",            @"lineHighlightColor",     NO },
+  { "selection",                 @"selectionColor",         NO },
+  { "selection_border",          @"selectionBorderColor",   NO },
+  { "inactive_selection",        @"inactiveSelectionColor", NO },
+  { "invisibles",                @"invisiblesColor",        NO },
+  { "caret",                     @"caretColor",             NO },
+  { "gutter_foreground",         @"gutterFGColor",          NO },
+  { "gutter",                    @"gutterBGColor",          NO },
+  { "find_highlight_foreground", @"findHiliteFGColor",      NO },
+  { "find_highlight",            @"findHiliteBGColor",      NO },
+};
+
+static const size_t g_globalKeyCount =
+  sizeof(g_globalKeys) / sizeof(g_globalKeys[0]);
+
+
+#pragma mark Reading
+
+static
+void
+failReader(QJSONReader *reader)
+{
+  reader->failed = YES;
+}
+
+
+static
+BOOL
+spanEquals(QJSONSpan span, const char *literal)
+{
+  size_t length = strlen(literal);
+  return span.length == length && memcmp(span.bytes, literal, length) == 0;
+}
+
+
+static
+BOOL
+spanContains(QJSONSpan span, const char *literal)
+{
+  size_t length = strlen(literal);
+  if (length == 0 || span.length < length) {
+    return NO;
+  }
+
+  const uint8_t *last = span.bytes + span.length - length;
+  for (const uint8_t *at = span.bytes; at <= last; ++at) {
+    if (*at == (uint8_t)literal[0] && memcmp(at, literal, length) == 0) {
+      return YES;
+    }
+  }
+  return NO;
+}
+
+
+static
+NSString *
+stringFromSpan(QJSONSpan span)
+{
+  return [[NSString alloc] initWithBytes:span.bytes
+                                  length:span.length
+                                encoding:NSUTF8StringEncoding];
+}
+
+
+// Like stringFromSpan(), but invalid UTF-8 fails the read instead of handing
+// back a nil string for the caller to trip over.
+static
+NSString *
+readerString(QJSONReader *reader, QJSONSpan span)
+{
+  NSString *string = stringFromSpan(span);
+  if (!string) {
+    failReader(reader);
+  }
+  return string;
+}
+
+
+static
+void
+skipSpace(QJSONReader *reader)
+{
+  const uint8_t *cursor = reader->cursor;
+  const uint8_t *end = reader->end;
+
+  while (cursor < end) {
+    switch (*cursor) {
+    case ' ': case '\t': case '\n': case '\r':
+      ++cursor;
+      break;
+
+    case '/':
+      if (cursor + 1 < end && cursor[1] == '/') {
+        cursor += 2;
+        while (cursor < end && *cursor != '\n') {
+          ++cursor;
+        }
+      } else if (cursor + 1 < end && cursor[1] == '*') {
+        cursor += 2;
+        while (cursor + 1 < end && !(cursor[0] == '*' && cursor[1] == '/')) {
+          ++cursor;
+        }
+        cursor = cursor + 1 < end ? cursor + 2 : end;
+      } else {
+        reader->cursor = cursor;
+        return;
+      }
+      break;
+
+    default:
+      reader->cursor = cursor;
+      return;
+    }
+  }
+
+  reader->cursor = cursor;
+}
+
+
+static
+BOOL
+consume(QJSONReader *reader, uint8_t ch)
+{
+  skipSpace(reader);
+  if (reader->cursor < reader->end && *reader->cursor == ch) {
+    ++reader->cursor;
+    return YES;
+  }
+  return NO;
+}
+
+
+static
+BOOL
+peek(QJSONReader *reader, uint8_t ch)
+{
+  skipSpace(reader);
+  return reader->cursor < reader->end && *reader->cursor == ch;
+}
+
+
+static
+int
+hexDigitValue(uint8_t ch)
+{
+  if (ch >= '0' && ch <= '9') {
+    return ch - '0';
+  } else if (ch >= 'a' && ch <= 'f') {
+    return ch - 'a' + 10;
+  } else if (ch >= 'A' && ch <= 'F') {
+    return ch - 'A' + 10;
+  }
+  return -1;
+}
+
+
+static
+BOOL
+readHex4(const uint8_t *bytes, const uint8_t *end, uint32_t *out)
+{
+  if (end - bytes < 4) {
+    return NO;
+  }
+
+  uint32_t value = 0;
+  for (int index = 0; index < 4; ++index) {
+    int digit = hexDigitValue(bytes[index]);
+    if (digit < 0) {
+      return NO;
+    }
+    value = (value << 4) | (uint32_t)digit;
+  }
+
+  *out = value;
+  return YES;
+}
+
+
+static
+void
+appendUTF8(NSMutableData *data, uint32_t codepoint)
+{
+  uint8_t buffer[4];
+  NSUInteger length = 0;
+
+  if (codepoint < 0x80) {
+    buffer[length++] = (uint8_t)codepoint;
+  } else if (codepoint < 0x800) {
+    buffer[length++] = (uint8_t)(0xC0 | (codepoint >> 6));
+    buffer[length++] = (uint8_t)(0x80 | (codepoint & 0x3F));
+  } else if (codepoint < 0x10000) {
+    buffer[length++] = (uint8_t)(0xE0 | (codepoint >> 12));
+    buffer[length++] = (uint8_t)(0x80 | ((codepoint >> 6) & 0x3F));
+    buffer[length++] = (uint8_t)(0x80 | (codepoint & 0x3F));
+  } else {
+    buffer[length++] = (uint8_t)(0xF0 | (codepoint >> 18));
+    buffer[length++] = (uint8_t)(0x80 | ((codepoint >> 12) & 0x3F));
+    buffer[length++] = (uint8_t)(0x80 | ((codepoint >> 6) & 0x3F));
+    buffer[length++] = (uint8_t)(0x80 | (codepoint & 0x3F));
+  }
+
+  [data appendBytes:buffer length:length];
+}
+
+
+// Decodes the escaped string starting at `from` into the reader's scratch
+// buffer. Returns the position of the closing quote or NULL on error.
+static
+const uint8_t *
+unescapeString(QJSONReader *reader, const uint8_t *from)
+{
+  NSMutableData *scratch = reader->scratch;
+  const uint8_t *cursor = from;
+  const uint8_t *end = reader->end;
+
+  scratch.length = 0;
+
+  while (cursor < end && *cursor != '"') {
+    const uint8_t *run = cursor;
+    while (cursor < end && *cursor != '"' && *cursor != '\\') {
+      ++cursor;
+    }
+
+    if (cursor > run) {
+      [scratch appendBytes:run length:cursor - run];
+    }
+
+    if (cursor >= end || *cursor == '"') {
+      break;
+    }
+
+    // Escape sequence
+    if (++cursor >= end) {
+      return NULL;
+    }
+
+    uint8_t escaped = 0;
+    switch (*cursor) {
+    case '"':  escaped = '"';  break;
+    case '\\': escaped = '\\'; break;
+    case '/':  escaped = '/';  break;
+    case 'b':  escaped = '\b'; break;
+    case 'f':  escaped = '\f'; break;
+    case 'n':  escaped = '\n'; break;
+    case 'r':  escaped = '\r'; break;
+    case 't':  escaped = '\t'; break;
+
+    case 'u': {
+      uint32_t codepoint = 0;
+      if (!readHex4(cursor + 1, end, &codepoint)) {
+        return NULL;
+      }
+      cursor += 5;
+
+      if (codepoint >= 0xD800 && codepoint < 0xDC00) {
+        uint32_t low = 0;
+        if (   end - cursor >= 6
+            && cursor[0] == '\\' && cursor[1] == 'u'
+            && readHex4(cursor + 2, end, &low)
+            && low >= 0xDC00 && low < 0xE000) {
+          codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+          cursor += 6;
+        } else {
+          codepoint = 0xFFFD;
+        }
+      }
+
+      appendUTF8(scratch, codepoint);
+      continue;
+    }
+
+    default:
+      return NULL;
+    }
+
+    [scratch appendBytes:&escaped length:1];
+    ++cursor;
+  }
+
+  return cursor < end ? cursor : NULL;
+}
+
+
+static
+BOOL
+readString(QJSONReader *reader, QJSONSpan *out)
+{
+  if (!consume(reader, '"')) {
+    failReader(reader);
+    return NO;
+  }
+
+  const uint8_t *start = reader->cursor;
+  const uint8_t *cursor = start;
+  const uint8_t *end = reader->end;
+
+  // Fast path: most strings in a color scheme have no escapes, so they can be
+  // referenced in place.
+  while (cursor < end && *cursor != '"' && *cursor != '\\') {
+    ++cursor;
+  }
+
+  if (cursor < end && *cursor == '"') {
+    out->bytes = start;
+    out->length = cursor - start;
+    reader->cursor = cursor + 1;
+    return YES;
+  }
+
+  cursor = unescapeString(reader, start);
+  if (!cursor) {
+    failReader(reader);
+    return NO;
+  }
+
+  out->bytes = reader->scratch.bytes;
+  out->length = reader->scratch.length;
+  reader->cursor = cursor + 1;
+  return YES;
+}
+
+
+static
+void
+skipValue(QJSONReader *reader);
+
+
+// Advances to the next member of an object whose opening brace has been
+// consumed, reading its key and the colon after it. first must start out YES
+// and be passed to every call for the same object. Members have to be
+// separated by commas, though like Sublime a trailing comma is allowed.
+static
+BOOL
+nextMember(QJSONReader *reader, QJSONSpan *key, BOOL *first)
+{
+  if (reader->failed || consume(reader, '}')) {
+    return NO;
+  }
+
+  if (!*first && !consume(reader, ',')) {
+    failReader(reader);
+    return NO;
+  }
+
+  *first = NO;
+  if (consume(reader, '}')) {
+    return NO;
+  }
+
+  if (!readString(reader, key) || !consume(reader, ':')) {
+    failReader(reader);
+    return NO;
+  }
+
+  return YES;
+}
+
+
+// Array counterpart to nextMember().
+static
+BOOL
+nextElement(QJSONReader *reader, BOOL *first)
+{
+  if (reader->failed || consume(reader, ']')) {
+    return NO;
+  }
+
+  if (!*first && !consume(reader, ',')) {
+    failReader(reader);
+    return NO;
+  }
+
+  *first = NO;
+  if (consume(reader, ']')) {
+    return NO;
+  }
+
+  if (reader->cursor >= reader->end) {
+    failReader(reader);
+    return NO;
+  }
+
+  return YES;
+}
+
+
+static
+BOOL
+isDigitByte(uint8_t ch)
+{
+  return ch >= '0' && ch <= '9';
+}
+
+
+static
+const uint8_t *
+skipDigits(const uint8_t *cursor, const uint8_t *end)
+{
+  while (cursor < end && isDigitByte(*cursor)) {
+    ++cursor;
+  }
+  return cursor;
+}
+
+
+// Skips a number as JSON defines it. Returns NO if there isn't one.
+static
+BOOL
+skipNumber(QJSONReader *reader)
+{
+  const uint8_t *cursor = reader->cursor;
+  const uint8_t *end = reader->end;
+
+  if (cursor < end && *cursor == '-') {
+    ++cursor;
+  }
+
+  const uint8_t *digits = cursor;
+  cursor = skipDigits(cursor, end);
+  if (cursor == digits || (*digits == '0' && cursor - digits > 1)) {
+    return NO;
+  }
+
+  if (cursor < end && *cursor == '.') {
+    digits = ++cursor;
+    cursor = skipDigits(cursor, end);
+    if (cursor == digits) {
+      return NO;
+    }
+  }
+
+  if (cursor < end && (*cursor == 'e' || *cursor == 'E')) {
+    ++cursor;
+    if (cursor < end && (*cursor == '+' || *cursor == '-')) {
+      ++cursor;
+    }
+
+    digits = cursor;
+    cursor = skipDigits(cursor, end);
+    if (cursor == digits) {
+      return NO;
+    }
+  }
+
+  reader->cursor = cursor;
+  return YES;
+}
+
+
+static
+BOOL
+skipLiteral(QJSONReader *reader, const char *literal)
+{
+  size_t length = strlen(literal);
+  if (   (size_t)(reader->end - reader->cursor) < length
+      || memcmp(reader->cursor, literal, length) != 0) {
+    return NO;
+  }
+
+  reader->cursor += length;
+  return YES;
+}
+
+
+static
+void
+skipValue(QJSONReader *reader)
+{
+  skipSpace(reader);
+  if (reader->cursor >= reader->end) {
+    failReader(reader);
+    return;
+  }
+
+  switch (*reader->cursor) {
+  case '"': {
+    QJSONSpan ignored;
+    readString(reader, &ignored);
+  } break;
+
+  case '{': {
+    ++reader->cursor;
+    QJSONSpan key;
+    BOOL first = YES;
+    while (nextMember(reader, &key, &first)) {
+      skipValue(reader);
+    }
+  } break;
+
+  case '[': {
+    ++reader->cursor;
+    BOOL first = YES;
+    while (nextElement(reader, &first)) {
+      skipValue(reader);
+    }
+  } break;
+
+  default:
+    // Anything that runs on past the literal is caught by the separator check
+    // in nextMember() or nextElement().
+    if (   !skipLiteral(reader, "true")
+        && !skipLiteral(reader, "false")
+        && !skipLiteral(reader, "null")
+        && !skipNumber(reader)) {
+      failReader(reader);
+    }
+    break;
+  }
+}
+
+
+// Reads a string value if the next value is a string. Any other value is
+// skipped and NO is returned.
+static
+BOOL
+readStringValue(QJSONReader *reader, QJSONSpan *out)
+{
+  if (peek(reader, '"')) {
+    return readString(reader, out);
+  }
+
+  skipValue(reader);
+  return NO;
+}
+
+
+static
+BOOL
+parseHexColor(QJSONSpan span, uint32_t *out)
+{
+  if (span.length < 1 || span.bytes[0] != '#') {
+    return NO;
+  }
+
+  NSUInteger digits = span.length - 1;
+
+  uint32_t value = 0;
+  for (NSUInteger index = 1; index < span.length; ++index) {
+    int digit = hexDigitValue(span.bytes[index]);
+    if (digit < 0) {
+      return NO;
+    }
+    value = (value << 4) | (uint32_t)digit;
+  }
+
+  switch (digits) {
+  case 3:
+  case 4: {
+    // Expand each nibble: #RGB(A) -> #RRGGBB(AA)
+    uint32_t expanded = 0;
+    for (NSUInteger shift = 0; shift < digits; ++shift) {
+      uint32_t nibble = (value >> (4 * (digits - 1 - shift))) & 0xF;
+      expanded = (expanded << 8) | (nibble << 4) | nibble;
+    }
+    *out = digits == 3 ? (expanded << 8) | 0xFF : expanded;
+  } return YES;
+
+  case 6:
+    *out = (value << 8) | 0xFF;
+    return YES;
+
+  case 8:
+    *out = value;
+    return YES;
+
+  default:
+    return NO;
+  }
+}
+
+
+static
+uint32_t
+flagsFromSpan(QJSONSpan span)
+{
+  uint32_t flags = QNoFlags;
+
+  if (spanContains(span, "bold")) {
+    flags |= QBoldFlag;
+  }
+
+  if (spanContains(span, "italic")) {
+    flags |= QItalicFlag;
+  }
+
+  if (spanContains(span, "underline")) {
+    flags |= QUnderlineFlag;
+  }
+
+  return flags;
+}
+
+
+static
+BOOL
+isSpaceByte(uint8_t ch)
+{
+  return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+}
+
+
+// Splits a comma-separated scope string into trimmed, non-empty selectors the
+// same way -[QSchemeRule initWithPropertyList:] does. Returns nil and fails the
+// reader if a selector isn't valid UTF-8.
+static
+NSArray *
+selectorsFromSpan(QJSONReader *reader, QJSONSpan span)
+{
+  NSMutableArray *selectors = [NSMutableArray array];
+  const uint8_t *cursor = span.bytes;
+  const uint8_t *end = span.bytes + span.length;
+
+  while (cursor <= end) {
+    const uint8_t *comma = cursor;
+    while (comma < end && *comma != ',') {
+      ++comma;
+    }
+
+    const uint8_t *first = cursor;
+    const uint8_t *last = comma;
+    while (first < last && isSpaceByte(*first)) {
+      ++first;
+    }
+    while (last > first && isSpaceByte(last[-1])) {
+      --last;
+    }
+
+    if (last > first) {
+      QJSONSpan selector = { first, last - first };
+      NSString *string = readerString(reader, selector);
+      if (!string) {
+        return nil;
+      }
+      [selectors addObject:string];
+    }
+
+    cursor = comma + 1;
+  }
+
+  return selectors;
+}
+
+
+// CSS color names, sorted for bsearch().
+typedef struct {
+  const char *name;
+  uint32_t rgba;
+} QJSONNamedColor;
+
+
+static const QJSONNamedColor g_namedColors[] = {
+  { "aliceblue",            0xF0F8FFFF },
+  { "antiquewhite",         0xFAEBD7FF },
+  { "aqua",                 0x00FFFFFF },
+  { "aquamarine",           0x7FFFD4FF },
+  { "azure",                0xF0FFFFFF },
+  { "beige",                0xF5F5DCFF },
+  { "bisque",               0xFFE4C4FF },
+  { "black",                0x000000FF },
+  { "blanchedalmond",       0xFFEBCDFF },
+  { "blue",                 0x0000FFFF },
+  { "blueviolet",           0x8A2BE2FF },
+  { "brown",                0xA52A2AFF },
+  { "burlywood",            0xDEB887FF },
+  { "cadetblue",            0x5F9EA0FF },
+  { "chartreuse",           0x7FFF00FF },
+  { "chocolate",            0xD2691EFF },
+  { "coral",                0xFF7F50FF },
+  { "cornflowerblue",       0x6495EDFF },
+  { "cornsilk",             0xFFF8DCFF },
+  { "crimson",              0xDC143CFF },
+  { "cyan",                 0x00FFFFFF },
+  { "darkblue",             0x00008BFF },
+  { "darkcyan",             0x008B8BFF },
+  { "darkgoldenrod",        0xB8860BFF },
+  { "darkgray",             0xA9A9A9FF },
+  { "darkgreen",            0x006400FF },
+  { "darkgrey",             0xA9A9A9FF },
+  { "darkkhaki",            0xBDB76BFF },
+  { "darkmagenta",          0x8B008BFF },
+  { "darkolivegreen",       0x556B2FFF },
+  { "darkorange",           0xFF8C00FF },
+  { "darkorchid",           0x9932CCFF },
+  { "darkred",              0x8B0000FF },
+  { "darksalmon",           0xE9967AFF },
+  { "darkseagreen",         0x8FBC8FFF },
+  { "darkslateblue",        0x483D8BFF },
+  { "darkslategray",        0x2F4F4FFF },
+  { "darkslategrey",        0x2F4F4FFF },
+  { "darkturquoise",        0x00CED1FF },
+  { "darkviolet",           0x9400D3FF },
+  { "deeppink",             0xFF1493FF },
+  { "deepskyblue",          0x00BFFFFF },
+  { "dimgray",              0x696969FF },
+  { "dimgrey",              0x696969FF },
+  { "dodgerblue",           0x1E90FFFF },
+  { "firebrick",            0xB22222FF },
+  { "floralwhite",          0xFFFAF0FF },
+  { "forestgreen",          0x228B22FF },
+  { "fuchsia",              0xFF00FFFF },
+  { "gainsboro",            0xDCDCDCFF },
+  { "ghostwhite",           0xF8F8FFFF },
+  { "gold",                 0xFFD700FF },
+  { "goldenrod",            0xDAA520FF },
+  { "gray",                 0x808080FF },
+  { "green",                0x008000FF },
+  { "greenyellow",          0xADFF2FFF },
+  { "grey",                 0x808080FF },
+  { "honeydew",             0xF0FFF0FF },
+  { "hotpink",              0xFF69B4FF },
+  { "indianred",            0xCD5C5CFF },
+  { "indigo",               0x4B0082FF },
+  { "ivory",                0xFFFFF0FF },
+  { "khaki",                0xF0E68CFF },
+  { "lavender",             0xE6E6FAFF },
+  { "lavenderblush",        0xFFF0F5FF },
+  { "lawngreen",            0x7CFC00FF },
+  { "lemonchiffon",         0xFFFACDFF },
+  { "lightblue",            0xADD8E6FF },
+  { "lightcoral",           0xF08080FF },
+  { "lightcyan",            0xE0FFFFFF },
+  { "lightgoldenrodyellow", 0xFAFAD2FF },
+  { "lightgray",            0xD3D3D3FF },
+  { "lightgreen",           0x90EE90FF },
+  { "lightgrey",            0xD3D3D3FF },
+  { "lightpink",            0xFFB6C1FF },
+  { "lightsalmon",          0xFFA07AFF },
+  { "lightseagreen",        0x20B2AAFF },
+  { "lightskyblue",         0x87CEFAFF },
+  { "lightslategray",       0x778899FF },
+  { "lightslategrey",       0x778899FF },
+  { "lightsteelblue",       0xB0C4DEFF },
+  { "lightyellow",          0xFFFFE0FF },
+  { "lime",                 0x00FF00FF },
+  { "limegreen",            0x32CD32FF },
+  { "linen",                0xFAF0E6FF },
+  { "magenta",              0xFF00FFFF },
+  { "maroon",               0x800000FF },
+  { "mediumaquamarine",     0x66CDAAFF },
+  { "mediumblue",           0x0000CDFF },
+  { "mediumorchid",         0xBA55D3FF },
+  { "mediumpurple",         0x9370DBFF },
+  { "mediumseagreen",       0x3CB371FF },
+  { "mediumslateblue",      0x7B68EEFF },
+  { "mediumspringgreen",    0x00FA9AFF },
+  { "mediumturquoise",      0x48D1CCFF },
+  { "mediumvioletred",      0xC71585FF },
+  { "midnightblue",         0x191970FF },
+  { "mintcream",            0xF5FFFAFF },
+  { "mistyrose",            0xFFE4E1FF },
+  { "moccasin",             0xFFE4B5FF },
+  { "navajowhite",          0xFFDEADFF },
+  { "navy",                 0x000080FF },
+  { "oldlace",              0xFDF5E6FF },
+  { "olive",                0x808000FF },
+  { "olivedrab",            0x6B8E23FF },
+  { "orange",               0xFFA500FF },
+  { "orangered",            0xFF4500FF },
+  { "orchid",               0xDA70D6FF },
+  { "palegoldenrod",        0xEEE8AAFF },
+  { "palegreen",            0x98FB98FF },
+  { "paleturquoise",        0xAFEEEEFF },
+  { "palevioletred",        0xDB7093FF },
+  { "papayawhip",           0xFFEFD5FF },
+  { "peachpuff",            0xFFDAB9FF },
+  { "peru",                 0xCD853FFF },
+  { "pink",                 0xFFC0CBFF },
+  { "plum",                 0xDDA0DDFF },
+  { "powderblue",           0xB0E0E6FF },
+  { "purple",               0x800080FF },
+  { "rebeccapurple",        0x663399FF },
+  { "red",                  0xFF0000FF },
+  { "rosybrown",            0xBC8F8FFF },
+  { "royalblue",            0x4169E1FF },
+  { "saddlebrown",          0x8B4513FF },
+  { "salmon",               0xFA8072FF },
+  { "sandybrown",           0xF4A460FF },
+  { "seagreen",             0x2E8B57FF },
+  { "seashell",             0xFFF5EEFF },
+  { "sienna",               0xA0522DFF },
+  { "silver",               0xC0C0C0FF },
+  { "skyblue",              0x87CEEBFF },
+  { "slateblue",            0x6A5ACDFF },
+  { "slategray",            0x708090FF },
+  { "slategrey",            0x708090FF },
+  { "snow",                 0xFFFAFAFF },
+  { "springgreen",          0x00FF7FFF },
+  { "steelblue",            0x4682B4FF },
+  { "tan",                  0xD2B48CFF },
+  { "teal",                 0x008080FF },
+  { "thistle",              0xD8BFD8FF },
+  { "tomato",               0xFF6347FF },
+  { "turquoise",            0x40E0D0FF },
+  { "violet",               0xEE82EEFF },
+  { "wheat",                0xF5DEB3FF },
+  { "white",                0xFFFFFFFF },
+  { "whitesmoke",           0xF5F5F5FF },
+  { "yellow",               0xFFFF00FF },
+  { "yellowgreen",          0x9ACD32FF },
+};
+
+static const size_t g_namedColorCount =
+  sizeof(g_namedColors) / sizeof(g_namedColors[0]);
+
+
+// Color components in [0, 1], kept unquantized until the color is finished so
+// that adjusters don't accumulate rounding error.
+typedef struct {
+  double red;
+  double green;
+  double blue;
+  double alpha;
+} QJSONColor;
+
+
+typedef struct {
+  const uint8_t *cursor;
+  const uint8_t *end;
+} QColorScanner;
+
+
+// None of these are retained by the context.
+typedef struct {
+  __unsafe_unretained NSDictionary *variables;       // <NSString, NSString>
+  __unsafe_unretained NSMutableDictionary *resolved; // <NSString, NSValue>
+  __unsafe_unretained NSMutableSet *resolving;       // Guards against cycles
+} QColorContext;
+
+
+static
+BOOL
+scanColor(QColorScanner *scanner, QColorContext *context, QJSONColor *out);
+
+
+static
+double
+clampUnit(double value)
+{
+  return value < 0.0 ? 0.0 : (value > 1.0 ? 1.0 : value);
+}
+
+
+static
+QJSONColor
+colorFromPacked(uint32_t rgba)
+{
+  return (QJSONColor){
+    ((rgba >> 24) & 0xFF) / 255.0,
+    ((rgba >> 16) & 0xFF) / 255.0,
+    ((rgba >> 8) & 0xFF) / 255.0,
+    (rgba & 0xFF) / 255.0
+  };
+}
+
+
+static
+uint32_t
+packColor(QJSONColor color)
+{
+  uint32_t red = (uint32_t)lround(clampUnit(color.red) * 255.0);
+  uint32_t green = (uint32_t)lround(clampUnit(color.green) * 255.0);
+  uint32_t blue = (uint32_t)lround(clampUnit(color.blue) * 255.0);
+  uint32_t alpha = (uint32_t)lround(clampUnit(color.alpha) * 255.0);
+  return (red << 24) | (green << 16) | (blue << 8) | alpha;
+}
+
+
+static
+double
+hueToChannel(double p, double q, double hue)
+{
+  if (hue < 0.0) {
+    hue += 1.0;
+  } else if (hue > 1.0) {
+    hue -= 1.0;
+  }
+
+  if (hue < 1.0 / 6.0) {
+    return p + (q - p) * 6.0 * hue;
+  } else if (hue < 0.5) {
+    return q;
+  } else if (hue < 2.0 / 3.0) {
+    return p + (q - p) * (2.0 / 3.0 - hue) * 6.0;
+  }
+  return p;
+}
+
+
+// Hue is in turns, saturation and lightness in [0, 1].
+static
+QJSONColor
+colorFromHSL(double hue, double saturation, double lightness, double alpha)
+{
+  hue -= floor(hue);
+  saturation = clampUnit(saturation);
+  lightness = clampUnit(lightness);
+
+  if (saturation == 0.0) {
+    return (QJSONColor){ lightness, lightness, lightness, alpha };
+  }
+
+  double q = lightness < 0.5
+    ? lightness * (1.0 + saturation)
+    : lightness + saturation - lightness * saturation;
+  double p = 2.0 * lightness - q;
+
+  return (QJSONColor){
+    hueToChannel(p, q, hue + 1.0 / 3.0),
+    hueToChannel(p, q, hue),
+    hueToChannel(p, q, hue - 1.0 / 3.0),
+    alpha
+  };
+}
+
+
+static
+void
+getHSL(QJSONColor color, double *hue, double *saturation, double *lightness)
+{
+  double maximum = MAX(color.red, MAX(color.green, color.blue));
+  double minimum = MIN(color.red, MIN(color.green, color.blue));
+  double delta = maximum - minimum;
+
+  *lightness = (maximum + minimum) / 2.0;
+
+  if (delta == 0.0) {
+    *hue = 0.0;
+    *saturation = 0.0;
+    return;
+  }
+
+  *saturation = *lightness > 0.5
+    ? delta / (2.0 - maximum - minimum)
+    : delta / (maximum + minimum);
+
+  if (maximum == color.red) {
+    *hue = (color.green - color.blue) / delta
+      + (color.green < color.blue ? 6.0 : 0.0);
+  } else if (maximum == color.green) {
+    *hue = (color.blue - color.red) / delta + 2.0;
+  } else {
+    *hue = (color.red - color.green) / delta + 4.0;
+  }
+  *hue /= 6.0;
+}
+
+
+static
+void
+scanSpace(QColorScanner *scanner)
+{
+  while (scanner->cursor < scanner->end && isSpaceByte(*scanner->cursor)) {
+    ++scanner->cursor;
+  }
+}
+
+
+static
+BOOL
+scanByte(QColorScanner *scanner, uint8_t ch)
+{
+  scanSpace(scanner);
+  if (scanner->cursor < scanner->end && *scanner->cursor == ch) {
+    ++scanner->cursor;
+    return YES;
+  }
+  return NO;
+}
+
+
+static
+BOOL
+isIdentifierByte(uint8_t ch)
+{
+  return
+       (ch >= 'a' && ch <= 'z')
+    || (ch >= 'A' && ch <= 'Z')
+    || (ch >= '0' && ch <= '9')
+    || ch == '-'
+    || ch == '_';
+}
+
+
+static
+QJSONSpan
+scanIdentifier(QColorScanner *scanner)
+{
+  scanSpace(scanner);
+  const uint8_t *start = scanner->cursor;
+  while (scanner->cursor < scanner->end && isIdentifierByte(*scanner->cursor)) {
+    ++scanner->cursor;
+  }
+  return (QJSONSpan){ start, scanner->cursor - start };
+}
+
+
+// Reads an unsigned decimal number, optionally followed by % or deg. strtod()
+// can't be used since spans aren't NUL-terminated.
+static
+BOOL
+scanNumber(QColorScanner *scanner, double *out, BOOL *outPercent)
+{
+  scanSpace(scanner);
+
+  double value = 0.0;
+  double scale = 1.0;
+  BOOL sawDigit = NO;
+  BOOL sawPoint = NO;
+
+  while (scanner->cursor < scanner->end) {
+    uint8_t ch = *scanner->cursor;
+    if (ch >= '0' && ch <= '9') {
+      if (sawPoint) {
+        scale /= 10.0;
+        value += (ch - '0') * scale;
+      } else {
+        value = value * 10.0 + (ch - '0');
+      }
+      sawDigit = YES;
+    } else if (ch == '.' && !sawPoint) {
+      sawPoint = YES;
+    } else {
+      break;
+    }
+    ++scanner->cursor;
+  }
+
+  if (!sawDigit) {
+    return NO;
+  }
+
+  *outPercent = NO;
+  if (scanner->cursor < scanner->end && *scanner->cursor == '%') {
+    ++scanner->cursor;
+    *outPercent = YES;
+  } else {
+    const uint8_t *unit = scanner->cursor;
+    while (   scanner->cursor < scanner->end
+           && isalpha((int)*scanner->cursor)) {
+      ++scanner->cursor;
+    }
+
+    QJSONSpan unitSpan = { unit, scanner->cursor - unit };
+    if (unitSpan.length > 0 && !spanEquals(unitSpan, "deg")) {
+      return NO;
+    }
+  }
+
+  *out = value;
+  return YES;
+}
+
+
+// Reads up to four comma-, space-, or slash-separated numbers and the closing
+// parenthesis of rgb(), hsl(), etc.
+static
+NSUInteger
+scanArguments(QColorScanner *scanner, double *values, BOOL *percents)
+{
+  NSUInteger count = 0;
+
+  while (!scanByte(scanner, ')')) {
+    if (count == 4) {
+      return 0;
+    } else if (count > 0 && !scanByte(scanner, ',')) {
+      scanByte(scanner, '/');
+    }
+
+    if (!scanNumber(scanner, &values[count], &percents[count])) {
+      return 0;
+    }
+    ++count;
+  }
+
+  return count;
+}
+
+
+static
+int
+compareNamedColor(const void *key, const void *element)
+{
+  const QJSONSpan *name = (const QJSONSpan *)key;
+  const char *candidate = ((const QJSONNamedColor *)element)->name;
+  size_t length = strlen(candidate);
+  int order = strncasecmp((const char *)name->bytes, candidate,
+                          MIN(name->length, length));
+
+  if (order != 0) {
+    return order;
+  }
+  return name->length < length ? -1 : (name->length > length ? 1 : 0);
+}
+
+
+static
+BOOL
+namedColor(QJSONSpan name, QJSONColor *out)
+{
+  if (spanEquals(name, "transparent")) {
+    *out = colorFromPacked(0);
+    return YES;
+  }
+
+  const QJSONNamedColor *found = bsearch(&name,
+                                         g_namedColors,
+                                         g_namedColorCount,
+                                         sizeof(QJSONNamedColor),
+                                         compareNamedColor);
+  if (found) {
+    *out = colorFromPacked(found->rgba);
+  }
+  return found != NULL;
+}
+
+
+static
+BOOL
+scanRGB(QColorScanner *scanner, QJSONColor *out)
+{
+  double values[4];
+  BOOL percents[4];
+  NSUInteger count = scanArguments(scanner, values, percents);
+
+  if (count != 3 && count != 4) {
+    return NO;
+  }
+
+  out->red = clampUnit(values[0] / (percents[0] ? 100.0 : 255.0));
+  out->green = clampUnit(values[1] / (percents[1] ? 100.0 : 255.0));
+  out->blue = clampUnit(values[2] / (percents[2] ? 100.0 : 255.0));
+  out->alpha =
+    count == 4 ? clampUnit(values[3] / (percents[3] ? 100.0 : 1.0)) : 1.0;
+  return YES;
+}
+
+
+static
+BOOL
+scanHSL(QColorScanner *scanner, QJSONColor *out)
+{
+  double values[4];
+  BOOL percents[4];
+  NSUInteger count = scanArguments(scanner, values, percents);
+
+  if (count != 3 && count != 4) {
+    return NO;
+  }
+
+  double alpha =
+    count == 4 ? clampUnit(values[3] / (percents[3] ? 100.0 : 1.0)) : 1.0;
+  *out = colorFromHSL(values[0] / 360.0,
+                      values[1] / 100.0,
+                      values[2] / 100.0,
+                      alpha);
+  return YES;
+}
+
+
+static
+BOOL
+resolveVariable(QJSONSpan nameSpan, QColorContext *context, QJSONColor *out)
+{
+  NSString *name = stringFromSpan(nameSpan);
+  NSValue *resolved = context->resolved[name];
+
+  if (resolved) {
+    [resolved getValue:out];
+    return YES;
+  }
+
+  NSString *value = name ? context->variables[name] : nil;
+  if (!value || [context->resolving containsObject:name]) {
+    return NO;
+  }
+
+  NSData *utf8 = [value dataUsingEncoding:NSUTF8StringEncoding];
+  QColorScanner scanner = {
+    utf8.bytes,
+    (const uint8_t *)utf8.bytes + utf8.length
+  };
+
+  [context->resolving addObject:name];
+  BOOL success = scanColor(&scanner, context, out);
+  [context->resolving removeObject:name];
+
+  scanSpace(&scanner);
+  if (!success || scanner.cursor != scanner.end) {
+    return NO;
+  }
+
+  context->resolved[name] = [NSValue valueWithBytes:out
+                                           objCType:@encode(QJSONColor)];
+  return YES;
+}
+
+
+// Reads the argument of an alpha(), saturation(), or lightness() adjuster,
+// which is either absolute or relative if it has a leading sign, and applies
+// it to value.
+static
+BOOL
+scanAdjustment(QColorScanner *scanner, double *value)
+{
+  double sign = 0.0;
+  double amount = 0.0;
+  BOOL percent = NO;
+
+  if (scanByte(scanner, '+')) {
+    sign = 1.0;
+  } else if (scanByte(scanner, '-')) {
+    sign = -1.0;
+  }
+
+  if (!scanNumber(scanner, &amount, &percent) || !scanByte(scanner, ')')) {
+    return NO;
+  }
+
+  if (percent) {
+    amount /= 100.0;
+  }
+
+  *value = clampUnit(sign == 0.0 ? amount : *value + sign * amount);
+  return YES;
+}
+
+
+// blend(<color> <percent>) and blenda(). The percentage is how much of the
+// base color is kept; blend() keeps the base color's alpha.
+static
+BOOL
+scanBlend(
+  QColorScanner *scanner,
+  QColorContext *context,
+  BOOL blendAlpha,
+  QJSONColor *color
+  )
+{
+  QJSONColor other;
+  double amount = 0.0;
+  BOOL percent = NO;
+
+  if (   !scanColor(scanner, context, &other)
+      || !scanNumber(scanner, &amount, &percent)
+      || !percent) {
+    return NO;
+  }
+
+  // Only RGB blending is supported.
+  QJSONSpan space = scanIdentifier(scanner);
+  if (   (space.length > 0 && !spanEquals(space, "rgb"))
+      || !scanByte(scanner, ')')) {
+    return NO;
+  }
+
+  double keep = clampUnit(amount / 100.0);
+  color->red = color->red * keep + other.red * (1.0 - keep);
+  color->green = color->green * keep + other.green * (1.0 - keep);
+  color->blue = color->blue * keep + other.blue * (1.0 - keep);
+  if (blendAlpha) {
+    color->alpha = color->alpha * keep + other.alpha * (1.0 - keep);
+  }
+  return YES;
+}
+
+
+// color(<color> <adjuster>...) -- supports alpha()/a(), saturation()/s(),
+// lightness()/l(), blend(), and blenda().
+static
+BOOL
+scanColorMod(QColorScanner *scanner, QColorContext *context, QJSONColor *out)
+{
+  if (!scanColor(scanner, context, out)) {
+    return NO;
+  }
+
+  while (!scanByte(scanner, ')')) {
+    QJSONSpan adjuster = scanIdentifier(scanner);
+    if (adjuster.length == 0 || !scanByte(scanner, '(')) {
+      return NO;
+    }
+
+    if (spanEquals(adjuster, "alpha") || spanEquals(adjuster, "a")) {
+      if (!scanAdjustment(scanner, &out->alpha)) {
+        return NO;
+      }
+    } else if (   spanEquals(adjuster, "saturation")
+               || spanEquals(adjuster, "s")
+               || spanEquals(adjuster, "lightness")
+               || spanEquals(adjuster, "l")) {
+      double hue, saturation, lightness;
+      getHSL(*out, &hue, &saturation, &lightness);
+
+      BOOL isSaturation = adjuster.bytes[0] == 's';
+      if (!scanAdjustment(scanner, isSaturation ? &saturation : &lightness)) {
+        return NO;
+      }
+
+      *out = colorFromHSL(hue, saturation, lightness, out->alpha);
+    } else if (   spanEquals(adjuster, "blend")
+               || spanEquals(adjuster, "blenda")) {
+      if (!scanBlend(scanner, context, adjuster.length == 6, out)) {
+        return NO;
+      }
+    } else {
+      return NO;
+    }
+  }
+
+  return YES;
+}
+
+
+static
+BOOL
+scanColor(QColorScanner *scanner, QColorContext *context, QJSONColor *out)
+{
+  if (scanByte(scanner, '#')) {
+    const uint8_t *start = scanner->cursor - 1;
+    while (   scanner->cursor < scanner->end
+           && hexDigitValue(*scanner->cursor) >= 0) {
+      ++scanner->cursor;
+    }
+
+    uint32_t rgba = 0;
+    if (!parseHexColor((QJSONSpan){ start, scanner->cursor - start }, &rgba)) {
+      return NO;
+    }
+    *out = colorFromPacked(rgba);
+    return YES;
+  }
+
+  QJSONSpan name = scanIdentifier(scanner);
+  if (name.length == 0) {
+    return NO;
+  } else if (!scanByte(scanner, '(')) {
+    return namedColor(name, out);
+  }
+
+  if (spanEquals(name, "var")) {
+    QJSONSpan variable = scanIdentifier(scanner);
+    return
+         scanByte(scanner, ')')
+      && resolveVariable(variable, context, out);
+  } else if (spanEquals(name, "rgb") || spanEquals(name, "rgba")) {
+    return scanRGB(scanner, out);
+  } else if (spanEquals(name, "hsl") || spanEquals(name, "hsla")) {
+    return scanHSL(scanner, out);
+  } else if (spanEquals(name, "color")) {
+    return scanColorMod(scanner, context, out);
+  }
+
+  return NO;
+}
+
+
+// Returns nil if the value isn't a color this reader understands, including
+// var() references to undefined variables.
+static
+NSColor *
+colorFromString(NSString *value, QColorContext *context)
+{
+  NSData *utf8 = [value dataUsingEncoding:NSUTF8StringEncoding];
+  QColorScanner scanner = {
+    utf8.bytes,
+    (const uint8_t *)utf8.bytes + utf8.length
+  };
+  QJSONColor color;
+
+  if (!scanColor(&scanner, context, &color)) {
+    return nil;
+  }
+
+  scanSpace(&scanner);
+  if (scanner.cursor != scanner.end) {
+    return nil;
+  }
+
+  return [NSColor colorFromPackedRGBA:packColor(color)];
+}
+
+
+// Reads a color value. Plain hex colors are applied right away; anything else
+// may refer to variables that haven't been read yet, so it's added to pending
+// as (target, key, value, opaque) and resolved once the whole file has been
+// read.
+static
+void
+readColorValue(
+  QJSONReader *reader,
+  id target,
+  NSString *key,
+  BOOL opaque,
+  NSMutableArray *pending
+  )
+{
+  QJSONSpan span;
+  if (!readStringValue(reader, &span)) {
+    return;
+  }
+
+  uint32_t rgba = 0;
+  if (parseHexColor(span, &rgba)) {
+    if (opaque) {
+      rgba |= 0xFF;
+    }
+    [target setValue:[NSColor colorFromPackedRGBA:rgba] forKey:key];
+  } else {
+    NSString *value = readerString(reader, span);
+    if (value) {
+      [pending addObject:@[target, key, value, @(opaque)]];
+    }
+  }
+}
+
+
+// Resolves the colors left pending by readColorValue. Returns the values that
+// couldn't be resolved, if any.
+static
+NSArray *
+resolvePendingColors(NSArray *pending, NSDictionary *variables)
+{
+  NSMutableArray *unsupported = [NSMutableArray array];
+  NSMutableDictionary *resolved NS_VALID_UNTIL_END_OF_SCOPE =
+    [NSMutableDictionary dictionary];
+  NSMutableSet *resolving NS_VALID_UNTIL_END_OF_SCOPE = [NSMutableSet set];
+  QColorContext context = { variables, resolved, resolving };
+
+  for (NSArray *entry in pending) {
+    NSString *value = entry[2];
+    NSColor *color = colorFromString(value, &context);
+
+    if (!color) {
+      [unsupported addObject:value];
+      continue;
+    } else if ([entry[3] boolValue]) {
+      color = [color colorWithAlphaComponent:1.0];
+    }
+
+    [entry[0] setValue:color forKey:entry[1]];
+  }
+
+  return unsupported;
+}
+
+
+// Variables are kept as strings -- they may hold things other than colors,
+// and may be referred to before they're declared -- and resolved on use.
+static
+void
+readVariables(QJSONReader *reader, NSMutableDictionary *variables)
+{
+  if (!consume(reader, '{')) {
+    skipValue(reader);
+    return;
+  }
+
+  QJSONSpan key;
+  BOOL first = YES;
+  while (nextMember(reader, &key, &first)) {
+    NSString *name = readerString(reader, key);
+    QJSONSpan value;
+    if (name && readStringValue(reader, &value)) {
+      NSString *string = readerString(reader, value);
+      if (string) {
+        variables[name] = string;
+      }
+    }
+  }
+}
+
+
+static
+void
+readGlobals(QJSONReader *reader, QScheme *scheme, NSMutableArray *pending)
+{
+  if (!consume(reader, '{')) {
+    skipValue(reader);
+    return;
+  }
+
+  QJSONSpan key;
+  BOOL first = YES;
+  while (nextMember(reader, &key, &first)) {
+    const QJSONGlobalKey *global = NULL;
+    for (size_t index = 0; index < g_globalKeyCount; ++index) {
+      if (spanEquals(key, g_globalKeys[index].jsonKey)) {
+        global = &g_globalKeys[index];
+        break;
+      }
+    }
+
+    if (!global) {
+      skipValue(reader);
+      continue;
+    }
+
+    readColorValue(reader,
+                   scheme,
+                   global->propertyKey,
+                   global->opaque,
+                   pending);
+  }
+}
+
+
+static
+QSchemeRule *
+readRule(QJSONReader *reader, NSMutableArray *pending)
+{
+  if (!consume(reader, '{')) {
+    skipValue(reader);
+    return nil;
+  }
+
+  QSchemeRule *rule = [QSchemeRule new];
+  QJSONSpan key;
+  QJSONSpan value;
+
+  // Mirrors -[QSchemeRule initWithPropertyList:], which takes the name as-is.
+  rule.name = nil;
+
+  BOOL first = YES;
+  while (nextMember(reader, &key, &first)) {
+    if (spanEquals(key, "name")) {
+      if (readStringValue(reader, &value)) {
+        rule.name = readerString(reader, value);
+      }
+    } else if (spanEquals(key, "scope")) {
+      if (readStringValue(reader, &value)) {
+        rule.selectors = selectorsFromSpan(reader, value);
+      }
+    } else if (spanEquals(key, "foreground")) {
+      readColorValue(reader, rule, @"foreground", NO, pending);
+    } else if (spanEquals(key, "background")) {
+      readColorValue(reader, rule, @"background", NO, pending);
+    } else if (spanEquals(key, "font_style")) {
+      if (readStringValue(reader, &value)) {
+        rule.flags = @(flagsFromSpan(value));
+      }
+    } else {
+      skipValue(reader);
+    }
+  }
+
+  return reader->failed ? nil : rule;
+}
+
+
+static
+NSArray *
+readRules(QJSONReader *reader, NSMutableArray *pending)
+{
+  if (!consume(reader, '[')) {
+    skipValue(reader);
+    return nil;
+  }
+
+  NSMutableArray *rules = [NSMutableArray array];
+  BOOL first = YES;
+  while (nextElement(reader, &first)) {
+    if (!peek(reader, '{')) {
+      skipValue(reader);
+      continue;
+    }
+
+    QSchemeRule *rule = readRule(reader, pending);
+    if (rule) {
+      [rules addObject:rule];
+    }
+  }
+
+  return rules;
+}
+
+
+#pragma mark Writing
+
+static
+void
+appendLiteral(NSMutableData *out, const char *literal)
+{
+  [out appendBytes:literal length:strlen(literal)];
+}
+
+
+static
+void
+appendString(NSMutableData *out, NSString *string)
+{
+  const char *utf8 = string.UTF8String;
+  const uint8_t *cursor = (const uint8_t *)(utf8 ? utf8 : "");
+  const uint8_t *run = cursor;
+
+  [out appendBytes:"\"" length:1];
+
+  for (; *cursor; ++cursor) {
+    uint8_t ch = *cursor;
+    if (ch >= 0x20 && ch != '"' && ch != '\\') {
+      continue;
+    }
+
+    if (cursor > run) {
+      [out appendBytes:run length:cursor - run];
+    }
+    run = cursor + 1;
+
+    switch (ch) {
+    case '"':  appendLiteral(out, "\\\""); break;
+    case '\\': appendLiteral(out, "\\\\"); break;
+    case '\n': appendLiteral(out, "\\n"); break;
+    case '\r': appendLiteral(out, "\\r"); break;
+    case '\t': appendLiteral(out, "\\t"); break;
+    default: {
+      char escaped[7];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+      [out appendBytes:escaped length:6];
+    } break;
+    }
+  }
+
+  if (cursor > run) {
+    [out appendBytes:run length:cursor - run];
+  }
+
+  [out appendBytes:"\"" length:1];
+}
+
+
+static
+void
+appendColor(NSMutableData *out, NSColor *color)
+{
+  static const char hexDigits[] = "0123456789abcdef";
+  uint32_t rgba = [color toPackedRGBA];
+  char buffer[11];
+  NSUInteger length = (rgba & 0xFF) == 0xFF ? 6 : 8;
+
+  buffer[0] = '"';
+  buffer[1] = '#';
+  for (NSUInteger index = 0; index < length; ++index) {
+    buffer[2 + index] = hexDigits[(rgba >> (28 - 4 * index)) & 0xF];
+  }
+  buffer[2 + length] = '"';
+
+  [out appendBytes:buffer length:length + 3];
+}
+
+
+static
+void
+appendKey(NSMutableData *out, const char *indent, const char *key, BOOL *first)
+{
+  appendLiteral(out, *first ? "\n" : ",\n");
+  appendLiteral(out, indent);
+  [out appendBytes:"\"" length:1];
+  appendLiteral(out, key);
+  appendLiteral(out, "\": ");
+  *first = NO;
+}
+
+
+static
+void
+appendFlags(NSMutableData *out, uint32_t flags)
+{
+  BOOL needsSpace = NO;
+
+  [out appendBytes:"\"" length:1];
+
+  if (flags & QBoldFlag) {
+    appendLiteral(out, "bold");
+    needsSpace = YES;
+  }
+
+  if (flags & QItalicFlag) {
+    appendLiteral(out, needsSpace ? " italic" : "italic");
+    needsSpace = YES;
+  }
+
+  if (flags & QUnderlineFlag) {
+    appendLiteral(out, needsSpace ? " underline" : "underline");
+  }
+
+  [out appendBytes:"\"" length:1];
+}
+
+
+static
+void
+appendRule(NSMutableData *out, QSchemeRule *rule)
+{
+  BOOL first = YES;
+  const char *indent = "      ";
+
+  appendLiteral(out, "    {");
+
+  if (rule.name) {
+    appendKey(out, indent, "name", &first);
+    appendString(out, rule.name);
+  }
+
+  appendKey(out, indent, "scope", &first);
+  appendString(out, [rule.selectors componentsJoinedByString:@", "]);
+
+  if (colorIsDefined(rule.foreground)) {
+    appendKey(out, indent, "foreground", &first);
+    appendColor(out, rule.foreground);
+  }
+
+  if (colorIsDefined(rule.background)) {
+    appendKey(out, indent, "background", &first);
+    appendColor(out, rule.background);
+  }
+
+  uint32_t flags = rule.flags.unsignedIntValue;
+  if (flags != QNoFlags) {
+    appendKey(out, indent, "font_style", &first);
+    appendFlags(out, flags);
+  }
+
+  appendLiteral(out, "\n    }");
+}
+
+
+@implementation QScheme (QJSON)
+
+- (id)initWithJSONData:(NSData *)data error:(NSError *__autoreleasing *)outError
+{
+  if (!(self = [self init])) {
+    return nil;
+  }
+
+  NSMutableData *scratch NS_VALID_UNTIL_END_OF_SCOPE =
+    [NSMutableData dataWithCapacity:256];
+  NSMutableDictionary *variables = [NSMutableDictionary dictionary];
+  NSMutableArray *pending = [NSMutableArray array];
+
+  QJSONReader reader = {
+    .start   = data.bytes,
+    .cursor  = data.bytes,
+    .end     = (const uint8_t *)data.bytes + data.length,
+    .failed  = NO,
+    .scratch = scratch
+  };
+
+  // Skip a UTF-8 BOM if present.
+  if (   reader.end - reader.cursor >= 3
+      && reader.cursor[0] == 0xEF
+      && reader.cursor[1] == 0xBB
+      && reader.cursor[2] == 0xBF) {
+    reader.cursor += 3;
+  }
+
+  BOOL sawGlobals = NO;
+
+  if (consume(&reader, '{')) {
+    QJSONSpan key;
+    QJSONSpan value;
+    BOOL first = YES;
+
+    while (nextMember(&reader, &key, &first)) {
+      if (spanEquals(key, "variables")) {
+        readVariables(&reader, variables);
+      } else if (spanEquals(key, "globals")) {
+        readGlobals(&reader, self, pending);
+        sawGlobals = YES;
+      } else if (spanEquals(key, "rules")) {
+        NSArray *rules = readRules(&reader, pending);
+        if (rules) {
+          self.rules = rules;
+        }
+      } else if (spanEquals(key, "uuid")) {
+        NSString *uuidString = nil;
+        if (readStringValue(&reader, &value)) {
+          uuidString = readerString(&reader, value);
+        }
+        if (uuidString) {
+          NSUUID *uuid = [[NSUUID alloc] initWithUUIDString:uuidString];
+          if (uuid) {
+            [self setValue:uuid forKey:@"uuid"];
+          } else {
+            NSLog(@"%@ is an invalid UUID, generating a new one.", uuidString);
+          }
+        }
+      } else {
+        skipValue(&reader);
+      }
+    }
+
+    // Nothing but whitespace and comments may follow the root object.
+    skipSpace(&reader);
+    if (reader.cursor != reader.end) {
+      failReader(&reader);
+    }
+  } else {
+    failReader(&reader);
+  }
+
+  if (reader.failed || !sawGlobals) {
+    if (outError) {
+      *outError = [NSError errorWithDomain:QInvalidJSONErrorDomain
+                                      code:reader.failed ? 1 : 2
+                                  userInfo:@{
+                     @"offset": @(reader.cursor - reader.start)
+                   }];
+    }
+    return nil;
+  }
+
+  // Colors are resolved only once everything's been read since key order
+  // doesn't mean anything in JSON -- variables may come after their uses.
+  NSArray *unsupported = resolvePendingColors(pending, variables);
+  if ([unsupported count]) {
+    if (outError) {
+      NSString *description =
+        [NSString stringWithFormat:@"Unsupported or undefined colors: %@",
+         [unsupported componentsJoinedByString:@", "]];
+      *outError = [NSError errorWithDomain:QInvalidJSONErrorDomain
+                                      code:3
+                                  userInfo:@{
+                     NSLocalizedDescriptionKey: description,
+                     @"values": unsupported
+                   }];
+    }
+    return nil;
+  }
+
+  return self;
+}
+
+
+- (NSData *)toJSONDataWithName:(NSString *)name
+{
+  // Roughly the size of an average rule, to avoid most regrowth.
+  NSMutableData *out =
+    [NSMutableData dataWithCapacity:512 + [self.rules count] * 160];
+  const char *indent = "    ";
+  BOOL first = YES;
+
+  appendLiteral(out, "{");
+
+  if (name) {
+    appendKey(out, "  ", "name", &first);
+    appendString(out, name);
+  }
+
+  appendKey(out, "  ", "uuid", &first);
+  appendString(out, self.uuid.UUIDString);
+
+  appendKey(out, "  ", "globals", &first);
+  appendLiteral(out, "{");
+
+  BOOL firstGlobal = YES;
+  for (size_t index = 0; index < g_globalKeyCount; ++index) {
+    const QJSONGlobalKey *global = &g_globalKeys[index];
+    NSColor *color = [self valueForKey:global->propertyKey];
+
+    if (global->opaque) {
+      color = [color colorWithAlphaComponent:1.0];
+    } else if (!colorIsDefined(color)) {
+      continue;
+    }
+
+    appendKey(out, indent, global->jsonKey, &firstGlobal);
+    appendColor(out, color);
+  }
+
+  appendLiteral(out, "\n  }");
+
+  appendKey(out, "  ", "rules", &first);
+  appendLiteral(out, "[");
+
+  BOOL firstRule = YES;
+  for (QSchemeRule *rule in self.rules) {
+    appendLiteral(out, firstRule ? "\n" : ",\n");
+    appendRule(out, rule);
+    firstRule = NO;
+  }
+
+  appendLiteral(out, firstRule ? "]\n}\n" : "\n  ]\n}\n");
+
+  return out;
+}
+
+@end
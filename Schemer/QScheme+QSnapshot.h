@@ -0,0 +1,95 @@
+/*===========================================================================
+  Copyright (c) 2014, Noel Cower.
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+  IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================*/
+
+/* QScheme+QSnapshot.h - Noel Cower */
+
+#import "QScheme.h"
+
+
+/*
+A binary snapshot of a scheme, used to reopen themes without going through the
+property list parser and colorSetting(). A snapshot is a fixed header (magic,
+version, checksum, the source file's size and modification date, base colors
+and UUID) followed by an array of fixed-size rule records, a selector table,
+and a single UTF-8 string blob. Colors are stored as packed RGBA; names and
+selectors are offset/length pairs into the string blob. Each rule record also
+carries the rule's contentHash.
+
+Snapshots are mapped rather than read, and rules are backed by the mapped
+records: a loaded rule is a QSchemeRule subclass holding only its record index
+and content hash, so opening a snapshot allocates one object per rule and
+rules can be hashed, diffed, and counted without touching their fields. A
+rule decodes its record the first time one of its properties is read or set,
+after which it's an ordinary rule. Snapshots are only ever replaced by atomic
+renames, never written in place, so a mapping stays valid for as long as any
+rule still refers to it. Validation is one pass of a word-wise checksum over
+the mapped file plus a bounds check of each record.
+
+A snapshot with the wrong magic or version, a bad checksum, out of range
+offsets, or a source stamp that doesn't match the file it was written for is
+rejected, and callers should fall back to the source file. Snapshots have to
+be written from a scheme as it reads back from the source file (see
+-[QScheme initWithPropertyList:]), not from an in-memory scheme that saving
+would normalize, or the two ways of opening the file would disagree.
+*/
+@interface QScheme (QSnapshot)
+
+// Location of the snapshot for the theme at the given file URL. Snapshots live
+// in the user's caches directory since the theme's own directory may not be
+// writable from the sandbox.
++ (NSURL *)snapshotURLForURL:(NSURL *)url;
+
+// Returns nil if there's no usable snapshot for url.
+- (id)initWithSnapshotOfURL:(NSURL *)url;
+// Returns nil if data isn't a valid snapshot of a file with the given stamp.
+- (id)initWithSnapshotData:(NSData *)data
+                sourceSize:(uint64_t)size
+              modifiedDate:(NSDate *)modified;
+
+// The size and modification date a snapshot of url is stamped with.
++ (BOOL)
+  getSnapshotStampOfURL:(NSURL *)url
+                   size:(uint64_t *)outSize
+           modifiedDate:(NSDate *__autoreleasing *)outModified;
+
+// Deletes the least recently written snapshots until at most maxCount remain
+// and they take up no more than maxBytes.
++ (void)trimSnapshotsToCount:(NSUInteger)maxCount bytes:(uint64_t)maxBytes;
+
+- (BOOL)writeSnapshotForURL:(NSURL *)url error:(NSError *__autoreleasing *)outError;
+// Writes a snapshot with a stamp taken earlier, e.g. before the file was read,
+// so that if the file has changed since the snapshot is simply rejected.
+- (BOOL)
+  writeSnapshotForURL:(NSURL *)url
+           sourceSize:(uint64_t)size
+         modifiedDate:(NSDate *)modified
+                error:(NSError *__autoreleasing *)outError;
+- (NSData *)toSnapshotDataWithSourceSize:(uint64_t)size
+                            modifiedDate:(NSDate *)modified;
+
+@end
@@ -0,0 +1,786 @@
+/*===========================================================================
+  Copyright (c) 2014, Noel Cower.
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+  IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================*/
+
+/* QScheme+QSnapshot.m - Noel Cower */
+
+#import "QScheme+QSnapshot.h"
+#import "QSchemeRule.h"
+#import "NSColor+QHexColor.h"
+#import "NSFilters.h"
+#import "aux.h"
+
+
+#define Q_SNAPSHOT_MAGIC       (0x53435351U) // 'QSCS' in file order
+#define Q_SNAPSHOT_VERSION     (3)
+#define Q_SNAPSHOT_COLOR_COUNT (12)
+#define Q_SNAPSHOT_NO_STRING   (UINT32_MAX)
+
+
+// Everything is stored in host byte order -- a snapshot written on a machine
+// of the other endianness fails the magic check and is rewritten.
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t headerSize;
+  // snapshotChecksum() of every byte following this field.
+  uint64_t checksum;
+
+  // Stamp of the file the snapshot was written for.
+  uint64_t sourceSize;
+  double sourceModified;
+
+  uint32_t colorMask; // Bit N set if colors[N] is defined
+  uint32_t colors[Q_SNAPSHOT_COLOR_COUNT];
+  uint8_t uuid[16];
+
+  uint32_t ruleCount;
+  uint32_t selectorCount;
+  uint32_t stringsLength;
+  uint32_t reserved;
+} QSnapshotHeader;
+
+
+typedef struct {
+  uint32_t offset;
+  uint32_t length; // Q_SNAPSHOT_NO_STRING for nil
+} QSnapshotString;
+
+
+typedef NS_OPTIONS(uint32_t, QSnapshotRulePresence) {
+  QSnapshotHasForeground = 1,
+  QSnapshotHasBackground = 2
+};
+
+
+typedef struct {
+  // The rule's contentHash, so rules can be compared and diffed without
+  // decoding any of the fields below.
+  uint64_t contentHash;
+  QSnapshotString name;
+  uint32_t selectorStart;
+  uint32_t selectorCount;
+  uint32_t foreground;
+  uint32_t background;
+  uint32_t flags;    // QSchemeRuleFlags
+  uint32_t presence; // QSnapshotRulePresence
+} QSnapshotRule;
+
+
+typedef struct {
+  const QSnapshotHeader *header;
+  const QSnapshotRule *rules;
+  const QSnapshotString *selectors;
+  const uint8_t *strings;
+} QSnapshotView;
+
+
+// Base colors in the order they're stored in QSnapshotHeader.colors. Changing
+// this list requires bumping Q_SNAPSHOT_VERSION.
+static NSString *const g_snapshotColorKeys[Q_SNAPSHOT_COLOR_COUNT] = {
+  @"foregroundColor",
+  @"backgroundColor",
+  @"lineHighlightColor",
+  @"selectionColor",
+  @"selectionBorderColor",
+  @"inactiveSelectionColor",
+  @"invisiblesColor",
+  @"caretColor",
+  @"gutterFGColor",
+  @"gutterBGColor",
+  @"findHiliteFGColor",
+  @"findHiliteBGColor"
+};
+
+
+static const size_t g_checksumOffset =
+  offsetof(QSnapshotHeader, checksum) + sizeof(uint64_t);
+
+
+#pragma mark Checksum
+
+static
+uint64_t
+rotateLeft(uint64_t value, int bits)
+{
+  return (value << bits) | (value >> (64 - bits));
+}
+
+
+static
+uint64_t
+checksumRound(uint64_t lane, uint64_t word)
+{
+  lane += word * 0xC2B2AE3D27D4EB4FULL;
+  return rotateLeft(lane, 31) * 0x9E3779B185EBCA87ULL;
+}
+
+
+// Checksum over whole 64-bit words in four independent lanes, so it runs at
+// close to memory speed rather than a byte per multiply like hashBytes. It's
+// only meant to catch truncated or damaged files, not to be a content hash.
+static
+uint64_t
+snapshotChecksum(const uint8_t *bytes, size_t length)
+{
+  uint64_t lanes[4] = {
+    Q_HASH_SEED,
+    Q_HASH_SEED + 1,
+    Q_HASH_SEED + 2,
+    Q_HASH_SEED + 3
+  };
+  size_t wordCount = length / sizeof(uint64_t);
+  size_t word = 0;
+
+  for (; word + 4 <= wordCount; word += 4) {
+    for (int lane = 0; lane < 4; ++lane) {
+      uint64_t value;
+      memcpy(&value, bytes + (word + lane) * sizeof(uint64_t), sizeof(value));
+      lanes[lane] = checksumRound(lanes[lane], value);
+    }
+  }
+
+  for (; word < wordCount; ++word) {
+    uint64_t value;
+    memcpy(&value, bytes + word * sizeof(uint64_t), sizeof(value));
+    lanes[0] = checksumRound(lanes[0], value);
+  }
+
+  uint64_t checksum =
+    hashPair(hashPair(lanes[0], lanes[1]), hashPair(lanes[2], lanes[3]));
+  checksum = hashUInt64(checksum, length);
+  checksum = hashBytes(checksum,
+                       bytes + wordCount * sizeof(uint64_t),
+                       length % sizeof(uint64_t));
+  return hashFinalize(checksum);
+}
+
+
+#pragma mark Reading
+
+static
+BOOL
+stringInBounds(QSnapshotString string, uint32_t stringsLength)
+{
+  if (string.length == Q_SNAPSHOT_NO_STRING) {
+    return YES;
+  }
+  return (uint64_t)string.offset + string.length <= stringsLength;
+}
+
+
+static
+NSString *
+stringFromSnapshot(const QSnapshotView *view, QSnapshotString string)
+{
+  if (string.length == Q_SNAPSHOT_NO_STRING) {
+    return nil;
+  }
+
+  return [[NSString alloc] initWithBytes:view->strings + string.offset
+                                  length:string.length
+                                encoding:NSUTF8StringEncoding];
+}
+
+
+// Checks the header, checksum, and every offset in the snapshot so that the
+// rest of the reader can index into it without further checks.
+static
+BOOL
+viewSnapshot(
+  NSData *data,
+  uint64_t sourceSize,
+  double sourceModified,
+  QSnapshotView *view
+  )
+{
+  const uint8_t *bytes = (const uint8_t *)[data bytes];
+  NSUInteger length = [data length];
+
+  if (length < sizeof(QSnapshotHeader)) {
+    return NO;
+  }
+
+  QSnapshotHeader header;
+  memcpy(&header, bytes, sizeof(header));
+
+  if (   header.magic != Q_SNAPSHOT_MAGIC
+      || header.version != Q_SNAPSHOT_VERSION
+      || header.headerSize != sizeof(QSnapshotHeader)) {
+    return NO;
+  }
+
+  if (   header.sourceSize != sourceSize
+      || header.sourceModified != sourceModified) {
+    return NO;
+  }
+
+  uint64_t expectedLength =
+      (uint64_t)sizeof(QSnapshotHeader)
+    + (uint64_t)header.ruleCount * sizeof(QSnapshotRule)
+    + (uint64_t)header.selectorCount * sizeof(QSnapshotString)
+    + header.stringsLength;
+
+  if (expectedLength != length) {
+    return NO;
+  }
+
+  uint64_t checksum = snapshotChecksum(bytes + g_checksumOffset,
+                                       length - g_checksumOffset);
+  if (checksum != header.checksum) {
+    return NO;
+  }
+
+  // Mapped data is page-aligned, the header and rule records are multiples of
+  // eight bytes, and string records of four, so the tables can be read in
+  // place.
+  view->header = (const QSnapshotHeader *)bytes;
+  view->rules = (const QSnapshotRule *)(bytes + sizeof(QSnapshotHeader));
+  view->selectors =
+    (const QSnapshotString *)(view->rules + header.ruleCount);
+  view->strings = (const uint8_t *)(view->selectors + header.selectorCount);
+
+  for (uint32_t index = 0; index < header.selectorCount; ++index) {
+    if (!stringInBounds(view->selectors[index], header.stringsLength)) {
+      return NO;
+    }
+  }
+
+  for (uint32_t index = 0; index < header.ruleCount; ++index) {
+    const QSnapshotRule *rule = &view->rules[index];
+    if (   !stringInBounds(rule->name, header.stringsLength)
+        || (uint64_t)rule->selectorStart + rule->selectorCount
+             > header.selectorCount) {
+      return NO;
+    }
+  }
+
+  return YES;
+}
+
+
+#pragma mark Snapshot-backed rules
+
+@interface QSchemeRule (QSnapshotBacking)
+- (void)primeContentHash:(uint64_t)contentHash;
+- (void)
+  restoreName:(NSString *)name
+    selectors:(NSArray *)selectors
+   foreground:(NSColor *)foreground
+   background:(NSColor *)background
+        flags:(NSNumber *)flags;
+@end
+
+
+// Keeps a validated snapshot mapped for as long as any rule still reads from
+// it.
+@interface QSnapshotStore : NSObject
+@property (readonly) const QSnapshotView *view;
+- (id)initWithData:(NSData *)data view:(QSnapshotView)view;
+@end
+
+
+@implementation QSnapshotStore {
+  NSData *_data;
+  QSnapshotView _view;
+}
+
+- (id)initWithData:(NSData *)data view:(QSnapshotView)view
+{
+  if ((self = [super init])) {
+    _data = data;
+    _view = view;
+  }
+  return self;
+}
+
+
+- (const QSnapshotView *)view
+{
+  return &_view;
+}
+
+@end
+
+
+// A rule backed by a record in a mapped snapshot. Until one of its fields is
+// read or set, it holds nothing but the record's index and content hash, so
+// loading a snapshot costs one object per rule. The first access decodes the
+// whole record and lets go of the snapshot.
+@interface QMappedRule : QSchemeRule
+- (id)initWithStore:(QSnapshotStore *)store record:(uint32_t)record;
+@end
+
+
+@implementation QMappedRule {
+  QSnapshotStore *_store;
+  uint32_t _record;
+}
+
+- (id)initWithStore:(QSnapshotStore *)store record:(uint32_t)record
+{
+  if ((self = [super init])) {
+    _store = store;
+    _record = record;
+    [self primeContentHash:store.view->rules[record].contentHash];
+  }
+  return self;
+}
+
+
+- (void)materialize
+{
+  QSnapshotStore *store = _store;
+  if (store == nil) {
+    return;
+  }
+
+  const QSnapshotView *view = store.view;
+  const QSnapshotRule *record = &view->rules[_record];
+  NSMutableArray *selectors =
+    [NSMutableArray arrayWithCapacity:record->selectorCount];
+
+  for (uint32_t index = 0; index < record->selectorCount; ++index) {
+    QSnapshotString selector = view->selectors[record->selectorStart + index];
+    [selectors addObject:stringFromSnapshot(view, selector) ?: @""];
+  }
+
+  _store = nil;
+  [self restoreName:stringFromSnapshot(view, record->name)
+          selectors:selectors
+         foreground:(record->presence & QSnapshotHasForeground)
+                      ? [NSColor colorFromPackedRGBA:record->foreground]
+                      : nil
+         background:(record->presence & QSnapshotHasBackground)
+                      ? [NSColor colorFromPackedRGBA:record->background]
+                      : nil
+              flags:@(record->flags)];
+}
+
+
+- (NSString *)name
+{
+  [self materialize];
+  return [super name];
+}
+
+
+- (NSArray *)selectors
+{
+  [self materialize];
+  return [super selectors];
+}
+
+
+- (NSColor *)foreground
+{
+  [self materialize];
+  return [super foreground];
+}
+
+
+- (NSColor *)background
+{
+  [self materialize];
+  return [super background];
+}
+
+
+- (NSNumber *)flags
+{
+  [self materialize];
+  return [super flags];
+}
+
+
+- (void)setName:(NSString *)name
+{
+  [self materialize];
+  [super setName:name];
+}
+
+
+- (void)setSelectors:(NSArray *)selectors
+{
+  [self materialize];
+  [super setSelectors:selectors];
+}
+
+
+- (void)setForeground:(NSColor *)foreground
+{
+  [self materialize];
+  [super setForeground:foreground];
+}
+
+
+- (void)setBackground:(NSColor *)background
+{
+  [self materialize];
+  [super setBackground:background];
+}
+
+
+- (void)setFlags:(NSNumber *)flags
+{
+  [self materialize];
+  [super setFlags:flags];
+}
+
+@end
+
+
+#pragma mark Writing
+
+static
+QSnapshotString
+appendString(NSMutableData *strings, NSString *string)
+{
+  if (string == nil) {
+    return (QSnapshotString){ 0, Q_SNAPSHOT_NO_STRING };
+  }
+
+  const char *utf8 = [string UTF8String];
+  size_t length = strlen(utf8);
+  QSnapshotString result = {
+    (uint32_t)[strings length],
+    (uint32_t)length
+  };
+
+  [strings appendBytes:utf8 length:length];
+  return result;
+}
+
+
+@implementation QScheme (QSnapshot)
+
++ (NSURL *)snapshotDirectoryURL
+{
+  NSFileManager *manager = [NSFileManager defaultManager];
+  NSURL *caches = [manager URLForDirectory:NSCachesDirectory
+                                  inDomain:NSUserDomainMask
+                         appropriateForURL:nil
+                                    create:YES
+                                     error:NULL];
+  if (caches == nil) {
+    return nil;
+  }
+
+  NSString *bundleID = [[NSBundle mainBundle] bundleIdentifier] ?: @"Schemer";
+  return [[caches URLByAppendingPathComponent:bundleID isDirectory:YES]
+          URLByAppendingPathComponent:@"Snapshots" isDirectory:YES];
+}
+
+
++ (NSURL *)snapshotURLForURL:(NSURL *)url
+{
+  NSURL *directory = [self snapshotDirectoryURL];
+  if (directory == nil) {
+    return nil;
+  }
+
+  NSString *path = url.URLByStandardizingPath.path;
+  uint64_t pathHash = hashFinalize(hashString(Q_HASH_SEED, path));
+  NSString *name = [NSString stringWithFormat:@"%016llx.qscs", pathHash];
+
+  return [directory URLByAppendingPathComponent:name isDirectory:NO];
+}
+
+
++ (BOOL)
+  getSnapshotStampOfURL:(NSURL *)url
+                   size:(uint64_t *)outSize
+           modifiedDate:(NSDate *__autoreleasing *)outModified
+{
+  NSNumber *size = nil;
+  NSDate *modified = nil;
+
+  if (   ![url getResourceValue:&size forKey:NSURLFileSizeKey error:NULL]
+      || ![url getResourceValue:&modified
+                         forKey:NSURLContentModificationDateKey
+                          error:NULL]
+      || size == nil
+      || modified == nil) {
+    return NO;
+  }
+
+  *outSize = size.unsignedLongLongValue;
+  *outModified = modified;
+  return YES;
+}
+
+
++ (void)trimSnapshotsToCount:(NSUInteger)maxCount bytes:(uint64_t)maxBytes
+{
+  NSURL *directory = [self snapshotDirectoryURL];
+  if (directory == nil) {
+    return;
+  }
+
+  NSFileManager *manager = [NSFileManager defaultManager];
+  NSArray *keys = @[NSURLContentModificationDateKey, NSURLFileSizeKey];
+  NSArray *snapshots =
+    [[manager contentsOfDirectoryAtURL:directory
+            includingPropertiesForKeys:keys
+                               options:NSDirectoryEnumerationSkipsHiddenFiles
+                                 error:NULL]
+     selectedBy:^BOOL(id obj) {
+       return [[obj pathExtension] isEqualToString:@"qscs"];
+     }];
+
+  // Newest first, so everything past the limits is the oldest.
+  snapshots =
+    [snapshots sortedArrayUsingComparator:^NSComparisonResult(id a, id b) {
+      NSDate *aModified = nil;
+      NSDate *bModified = nil;
+      [a getResourceValue:&aModified
+                   forKey:NSURLContentModificationDateKey
+                    error:NULL];
+      [b getResourceValue:&bModified
+                   forKey:NSURLContentModificationDateKey
+                    error:NULL];
+      return [bModified ?: [NSDate distantPast]
+               compare:aModified ?: [NSDate distantPast]];
+    }];
+
+  NSUInteger count = 0;
+  uint64_t bytes = 0;
+
+  for (NSURL *snapshot in snapshots) {
+    NSNumber *size = nil;
+    [snapshot getResourceValue:&size forKey:NSURLFileSizeKey error:NULL];
+
+    count += 1;
+    bytes += size.unsignedLongLongValue;
+
+    if (count > maxCount || bytes > maxBytes) {
+      [manager removeItemAtURL:snapshot error:NULL];
+    }
+  }
+}
+
+
+- (id)initWithSnapshotOfURL:(NSURL *)url
+{
+  uint64_t size = 0;
+  NSDate *modified = nil;
+  NSURL *snapshotURL = [QScheme snapshotURLForURL:url];
+
+  if (   snapshotURL == nil
+      || ![QScheme getSnapshotStampOfURL:url
+                                    size:&size
+                            modifiedDate:&modified]) {
+    return nil;
+  }
+
+  NSData *data = [NSData dataWithContentsOfURL:snapshotURL
+                                       options:NSDataReadingMappedAlways
+                                         error:NULL];
+  if (data == nil) {
+    return nil;
+  }
+
+  return [self initWithSnapshotData:data sourceSize:size modifiedDate:modified];
+}
+
+
+- (id)initWithSnapshotData:(NSData *)data
+                sourceSize:(uint64_t)size
+              modifiedDate:(NSDate *)modified
+{
+  QSnapshotView view;
+
+  if (!viewSnapshot(data, size, modified.timeIntervalSinceReferenceDate, &view)) {
+    return nil;
+  }
+
+  if ((self = [self init])) {
+    const QSnapshotHeader *header = view.header;
+
+    for (int index = 0; index < Q_SNAPSHOT_COLOR_COUNT; ++index) {
+      NSColor *color = nil;
+      if (header->colorMask & (1U << index)) {
+        color = [NSColor colorFromPackedRGBA:header->colors[index]];
+      }
+      [self setValue:color forKey:g_snapshotColorKeys[index]];
+    }
+
+    [self setValue:[[NSUUID alloc] initWithUUIDBytes:header->uuid]
+            forKey:@"uuid"];
+
+    uint32_t ruleCount = header->ruleCount;
+    QSnapshotStore *store = [[QSnapshotStore alloc] initWithData:data
+                                                            view:view];
+    NSMutableArray *rules = [NSMutableArray arrayWithCapacity:ruleCount];
+    for (uint32_t index = 0; index < ruleCount; ++index) {
+      [rules addObject:[[QMappedRule alloc] initWithStore:store record:index]];
+    }
+
+    self.rules = rules;
+  }
+
+  return self;
+}
+
+
+- (BOOL)writeSnapshotForURL:(NSURL *)url error:(NSError *__autoreleasing *)outError
+{
+  uint64_t size = 0;
+  NSDate *modified = nil;
+
+  if (![QScheme getSnapshotStampOfURL:url size:&size modifiedDate:&modified]) {
+    if (outError) {
+      *outError = [NSError errorWithDomain:@"QCannotWriteSnapshot"
+                                      code:1
+                                  userInfo:@{ @"url": url }];
+    }
+    return NO;
+  }
+
+  return [self writeSnapshotForURL:url
+                        sourceSize:size
+                      modifiedDate:modified
+                             error:outError];
+}
+
+
+- (BOOL)
+  writeSnapshotForURL:(NSURL *)url
+           sourceSize:(uint64_t)size
+         modifiedDate:(NSDate *)modified
+                error:(NSError *__autoreleasing *)outError
+{
+  NSURL *snapshotURL = [QScheme snapshotURLForURL:url];
+
+  if (snapshotURL == nil) {
+    if (outError) {
+      *outError = [NSError errorWithDomain:@"QCannotWriteSnapshot"
+                                      code:1
+                                  userInfo:@{ @"url": url }];
+    }
+    return NO;
+  }
+
+  NSURL *directory = [snapshotURL URLByDeletingLastPathComponent];
+  if (![[NSFileManager defaultManager] createDirectoryAtURL:directory
+                                withIntermediateDirectories:YES
+                                                 attributes:nil
+                                                      error:outError]) {
+    return NO;
+  }
+
+  NSData *data = [self toSnapshotDataWithSourceSize:size modifiedDate:modified];
+  return [data writeToURL:snapshotURL options:NSDataWritingAtomic error:outError];
+}
+
+
+- (NSData *)toSnapshotDataWithSourceSize:(uint64_t)size
+                            modifiedDate:(NSDate *)modified
+{
+  NSArray *rules = self.rules;
+  NSUInteger ruleCount = [rules count];
+  NSUInteger selectorCount = 0;
+
+  for (QSchemeRule *rule in rules) {
+    selectorCount += [rule.selectors count];
+  }
+
+  QSnapshotHeader header = {
+    .magic = Q_SNAPSHOT_MAGIC,
+    .version = Q_SNAPSHOT_VERSION,
+    .headerSize = sizeof(QSnapshotHeader),
+    .sourceSize = size,
+    .sourceModified = modified.timeIntervalSinceReferenceDate,
+    .ruleCount = (uint32_t)ruleCount,
+    .selectorCount = (uint32_t)selectorCount
+  };
+
+  for (int index = 0; index < Q_SNAPSHOT_COLOR_COUNT; ++index) {
+    NSColor *color = [self valueForKey:g_snapshotColorKeys[index]];
+    if (color) {
+      header.colorMask |= 1U << index;
+      header.colors[index] = [color toPackedRGBA];
+    }
+  }
+
+  [self.uuid getUUIDBytes:header.uuid];
+
+  size_t tablesLength =
+      ruleCount * sizeof(QSnapshotRule)
+    + selectorCount * sizeof(QSnapshotString);
+  NSMutableData *out =
+    [NSMutableData dataWithLength:sizeof(QSnapshotHeader) + tablesLength];
+  NSMutableData *strings = [NSMutableData dataWithCapacity:ruleCount * 64];
+
+  uint8_t *bytes = (uint8_t *)[out mutableBytes];
+  QSnapshotRule *ruleRecords = (QSnapshotRule *)(bytes + sizeof(QSnapshotHeader));
+  QSnapshotString *selectorRecords =
+    (QSnapshotString *)(ruleRecords + ruleCount);
+  uint32_t selectorIndex = 0;
+
+  for (NSUInteger index = 0; index < ruleCount; ++index) {
+    QSchemeRule *rule = rules[index];
+    QSnapshotRule *record = &ruleRecords[index];
+    NSColor *foreground = rule.foreground;
+    NSColor *background = rule.background;
+
+    record->contentHash = rule.contentHash;
+    record->name = appendString(strings, rule.name);
+    record->selectorStart = selectorIndex;
+    record->selectorCount = (uint32_t)[rule.selectors count];
+
+    for (NSString *selector in rule.selectors) {
+      selectorRecords[selectorIndex++] = appendString(strings, selector);
+    }
+
+    if (foreground) {
+      record->presence |= QSnapshotHasForeground;
+      record->foreground = [foreground toPackedRGBA];
+    }
+
+    if (background) {
+      record->presence |= QSnapshotHasBackground;
+      record->background = [background toPackedRGBA];
+    }
+
+    record->flags = rule.flags.unsignedIntValue;
+  }
+
+  header.stringsLength = (uint32_t)[strings length];
+  [out appendData:strings];
+
+  // The checksum covers the rest of the header, so write it out first.
+  bytes = (uint8_t *)[out mutableBytes];
+  memcpy(bytes, &header, sizeof(header));
+  header.checksum = snapshotChecksum(bytes + g_checksumOffset,
+                                     [out length] - g_checksumOffset);
+  memcpy(bytes, &header, sizeof(header));
+
+  return out;
+}
+
+@end
@@ -54,6 +54,13 @@
 
 @property (copy, readonly) NSUUID *uuid;
 
+// Merkle-style hash over the rules' content hashes, in order. Only the
+// branches above rules whose content changed are recomputed.
+@property (readonly) uint64_t rulesHash;
+// Hash of the base colors, UUID, and rulesHash. Schemes with equal content
+// hashes are almost certainly -isEqual:.
+@property (readonly) uint64_t contentHash;
+
 - (id)init;
 - (id)initWithPropertyList:(NSDictionary *)plist;
 - (id)initWithScheme:(QScheme *)scheme;
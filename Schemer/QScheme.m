@@ -48,6 +48,32 @@ NSArray *
 getRulesDictionaries(NSArray *settings);
 
 
+static
+NSArray *
+schemeColorKeys()
+{
+  static NSArray *keys = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    keys = @[
+      @"foregroundColor",
+      @"backgroundColor",
+      @"lineHighlightColor",
+      @"selectionColor",
+      @"selectionBorderColor",
+      @"inactiveSelectionColor",
+      @"invisiblesColor",
+      @"caretColor",
+      @"gutterFGColor",
+      @"gutterBGColor",
+      @"findHiliteFGColor",
+      @"findHiliteBGColor"
+    ];
+  });
+  return keys;
+}
+
+
 static id (^const copyRuleBlock)(id) = ^(id obj) {
   return [obj copy];
 };
@@ -100,6 +126,18 @@ getRulesDictionaries(NSArray *settings)
 }
 
 
+#pragma mark Private API for QSchemeRule
+
+@interface QSchemeRule (QRulesHashTree)
+
+- (BOOL)attachToHashTree:(QScheme *)scheme leaf:(NSUInteger)leaf;
+- (void)detachFromHashTree:(QScheme *)scheme;
+
+@end
+
+
+#pragma mark Private interface
+
 @interface QScheme ()
 
 @property (copy, readwrite) NSUUID *uuid;
@@ -107,7 +145,28 @@ getRulesDictionaries(NSArray *settings)
 @end
 
 
-@implementation QScheme
+#pragma mark Implementation
+
+@implementation QScheme {
+  // Rules array the hash tree was built from and the tree itself, leaves
+  // first. Each level is an NSMutableData of uint64_t.
+  NSArray *_hashedRules;
+  NSMutableArray *_hashLevels;
+  // Leaves whose rules reported a change since the tree was last updated.
+  NSMutableIndexSet *_dirtyLeaves;
+  // Set if some rule couldn't attach to the tree (because it's also in
+  // another scheme's tree or appears twice), in which case changes to it
+  // aren't reported and every leaf has to be checked on update.
+  BOOL _checkAllLeaves;
+}
+
+- (void)dealloc
+{
+  for (QSchemeRule *rule in _hashedRules) {
+    [rule detachFromHashTree:self];
+  }
+}
+
 
 - (id)init
 {
@@ -234,6 +293,10 @@ getRulesDictionaries(NSArray *settings)
     self.inactiveSelectionColor = scheme.inactiveSelectionColor;
     self.invisiblesColor        = scheme.invisiblesColor;
     self.caretColor             = scheme.caretColor;
+    self.gutterFGColor          = scheme.gutterFGColor;
+    self.gutterBGColor          = scheme.gutterBGColor;
+    self.findHiliteFGColor      = scheme.findHiliteFGColor;
+    self.findHiliteBGColor      = scheme.findHiliteBGColor;
     self.rules                  = [scheme.rules mappedTo:copyRuleBlock];
     self.uuid                   = scheme.uuid;
   }
@@ -247,6 +310,183 @@ getRulesDictionaries(NSArray *settings)
 }
 
 
+#pragma mark Content hashing
+
+- (void)buildRulesHashTree:(NSArray *)rules
+{
+  NSUInteger count = [rules count];
+  NSMutableData *leaves =
+    [NSMutableData dataWithLength:sizeof(uint64_t) * count];
+  uint64_t *leafHashes = (uint64_t *)leaves.mutableBytes;
+
+  for (QSchemeRule *rule in _hashedRules) {
+    [rule detachFromHashTree:self];
+  }
+
+  _checkAllLeaves = NO;
+  _dirtyLeaves = [NSMutableIndexSet new];
+
+  NSUInteger index = 0;
+  for (QSchemeRule *rule in rules) {
+    if (![rule attachToHashTree:self leaf:index]) {
+      _checkAllLeaves = YES;
+    }
+    leafHashes[index++] = rule.contentHash;
+  }
+
+  _hashLevels = [NSMutableArray arrayWithObject:leaves];
+
+  while (count > 1) {
+    NSUInteger parentCount = (count + 1) / 2;
+    const uint64_t *children = [[_hashLevels lastObject] bytes];
+    NSMutableData *level =
+      [NSMutableData dataWithLength:sizeof(uint64_t) * parentCount];
+    uint64_t *parents = (uint64_t *)level.mutableBytes;
+
+    for (NSUInteger parent = 0; parent < parentCount; ++parent) {
+      NSUInteger left = parent * 2;
+      parents[parent] =
+        left + 1 < count
+        ? hashPair(children[left], children[left + 1])
+        : children[left];
+    }
+
+    [_hashLevels addObject:level];
+    count = parentCount;
+  }
+
+  _hashedRules = rules;
+}
+
+
+- (void)ruleDidChangeAtLeaf:(NSUInteger)leaf
+{
+  [_dirtyLeaves addIndex:leaf];
+}
+
+
+- (void)updateRulesHashTree
+{
+  NSArray *rules = _hashedRules;
+  uint64_t *leafHashes = (uint64_t *)[_hashLevels[0] mutableBytes];
+  NSMutableIndexSet *dirty = _dirtyLeaves;
+
+  _dirtyLeaves = [NSMutableIndexSet new];
+
+  if (_checkAllLeaves) {
+    NSUInteger index = 0;
+    for (QSchemeRule *rule in rules) {
+      uint64_t hash = rule.contentHash;
+      if (hash != leafHashes[index]) {
+        leafHashes[index] = hash;
+        [dirty addIndex:index];
+      }
+      ++index;
+    }
+  } else {
+    [dirty enumerateIndexesUsingBlock:^(NSUInteger leaf, BOOL *stop) {
+      leafHashes[leaf] = [rules[leaf] contentHash];
+    }];
+  }
+
+  NSUInteger count = [rules count];
+  NSUInteger levelCount = [_hashLevels count];
+
+  for (NSUInteger level = 1; level < levelCount && [dirty count]; ++level) {
+    const uint64_t *children = [_hashLevels[level - 1] bytes];
+    uint64_t *parents = (uint64_t *)[_hashLevels[level] mutableBytes];
+    NSMutableIndexSet *dirtyParents = [NSMutableIndexSet new];
+
+    [dirty enumerateIndexesUsingBlock:^(NSUInteger child, BOOL *stop) {
+      [dirtyParents addIndex:child / 2];
+    }];
+
+    [dirtyParents enumerateIndexesUsingBlock:^(NSUInteger parent, BOOL *stop) {
+      NSUInteger left = parent * 2;
+      parents[parent] =
+        left + 1 < count
+        ? hashPair(children[left], children[left + 1])
+        : children[left];
+    }];
+
+    dirty = dirtyParents;
+    count = (count + 1) / 2;
+  }
+}
+
+
+- (uint64_t)rulesHash
+{
+  NSArray *rules = self.rules;
+
+  // rules is a copy property, so a different array means the list itself was
+  // replaced and the tree has to be rebuilt. Otherwise only the leaves of
+  // rules that reported a change, and the branches above them, are rehashed.
+  if (rules != _hashedRules || !_hashLevels) {
+    [self buildRulesHashTree:rules];
+  } else {
+    [self updateRulesHashTree];
+  }
+
+  NSData *root = [_hashLevels lastObject];
+  uint64_t rootHash = [rules count] ? *(const uint64_t *)root.bytes : 0;
+
+  return hashPair(rootHash, [rules count]);
+}
+
+
+- (uint64_t)contentHash
+{
+  uint64_t hash = Q_HASH_SEED;
+
+  for (NSString *key in schemeColorKeys()) {
+    hash = hashUInt64(hash, [[self valueForKey:key] toPackedRGBA]);
+  }
+
+  uuid_t uuid;
+  [self.uuid getUUIDBytes:uuid];
+  hash = hashBytes(hash, uuid, sizeof(uuid));
+  hash = hashUInt64(hash, self.rulesHash);
+
+  return hashFinalize(hash);
+}
+
+
+- (BOOL)isEqual:(id)object
+{
+  if (object == self) {
+    return YES;
+  } else if (![object isKindOfClass:[QScheme class]]) {
+    return NO;
+  }
+
+  QScheme *other = (QScheme *)object;
+
+  if (self.contentHash != other.contentHash) {
+    return NO;
+  }
+
+  for (NSString *key in schemeColorKeys()) {
+    if ([[self valueForKey:key] toPackedRGBA]
+        != [[other valueForKey:key] toPackedRGBA]) {
+      return NO;
+    }
+  }
+
+  return
+       [self.uuid isEqual:other.uuid]
+    && [self.rules isEqualToArray:other.rules];
+}
+
+
+- (NSUInteger)hash
+{
+  return (NSUInteger)self.contentHash;
+}
+
+
+#pragma mark Property lists
+
 - (NSDictionary *)toPropertyList
 {
   NSMutableDictionary *plist = [NSMutableDictionary new];
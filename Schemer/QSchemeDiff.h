@@ -0,0 +1,57 @@
+/*===========================================================================
+  Copyright (c) 2014, Noel Cower.
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+  IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================*/
+
+/* QSchemeDiff.h - Noel Cower */
+
+#import <Foundation/Foundation.h>
+
+
+@class QScheme;
+
+
+/*
+Structural diff between two rule lists, built on QSchemeRule content hashes.
+
+Rules are paired first by identical content, then by name, then by selectors.
+Paired rules whose content differs are modified; paired rules that fall
+outside the longest run of pairs still in their original relative order are
+moved. Anything left over was removed from the old list or inserted into the
+new one. Runs in O(n log n).
+*/
+@interface QSchemeDiff : NSObject
+
+@property (copy, readonly) NSIndexSet *insertedIndexes;   // Indices in new rules
+@property (copy, readonly) NSIndexSet *removedIndexes;    // Indices in old rules
+@property (copy, readonly) NSDictionary *movedIndexes;    // Old index -> new index
+@property (copy, readonly) NSDictionary *modifiedIndexes; // Old index -> new index
+@property (readonly, getter=isEmpty) BOOL empty;
+
++ (QSchemeDiff *)diffFromRules:(NSArray *)oldRules toRules:(NSArray *)newRules;
++ (QSchemeDiff *)diffFromScheme:(QScheme *)oldScheme toScheme:(QScheme *)newScheme;
+
+@end
@@ -0,0 +1,272 @@
+/*===========================================================================
+  Copyright (c) 2014, Noel Cower.
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+  IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================*/
+
+/* QSchemeDiff.m - Noel Cower */
+
+#import "QSchemeDiff.h"
+#import "QScheme.h"
+#import "QSchemeRule.h"
+#import "aux.h"
+
+
+typedef uint64_t (^QDiffKeyBlock)(QSchemeRule *rule);
+
+
+typedef struct {
+  uint64_t key;
+  NSUInteger index;
+} QDiffEntry;
+
+
+static
+int
+compareEntries(const void *lhs, const void *rhs)
+{
+  const QDiffEntry *left = (const QDiffEntry *)lhs;
+  const QDiffEntry *right = (const QDiffEntry *)rhs;
+
+  if (left->key != right->key) {
+    return left->key < right->key ? -1 : 1;
+  } else if (left->index != right->index) {
+    return left->index < right->index ? -1 : 1;
+  }
+  return 0;
+}
+
+
+static
+QDiffEntry *
+unpairedEntries(
+  NSArray *rules,
+  const NSUInteger *pairs,
+  QDiffKeyBlock keyFor,
+  NSUInteger *outCount
+  )
+{
+  NSUInteger count = [rules count];
+  QDiffEntry *entries = malloc(sizeof(QDiffEntry) * MAX(count, 1));
+  NSUInteger unpaired = 0;
+
+  for (NSUInteger index = 0; index < count; ++index) {
+    if (pairs[index] == NSNotFound) {
+      entries[unpaired].key = keyFor(rules[index]);
+      entries[unpaired].index = index;
+      ++unpaired;
+    }
+  }
+
+  qsort(entries, unpaired, sizeof(QDiffEntry), compareEntries);
+  *outCount = unpaired;
+  return entries;
+}
+
+
+// Pairs up rules not yet paired whose keys match. Rules with the same key are
+// paired in order of appearance.
+static
+void
+pairRules(
+  NSArray *oldRules,
+  NSArray *newRules,
+  NSUInteger *oldToNew,
+  NSUInteger *newToOld,
+  QDiffKeyBlock keyFor,
+  BOOL requireEqual
+  )
+{
+  NSUInteger oldCount = 0;
+  NSUInteger newCount = 0;
+  QDiffEntry *oldEntries = unpairedEntries(oldRules, oldToNew, keyFor, &oldCount);
+  QDiffEntry *newEntries = unpairedEntries(newRules, newToOld, keyFor, &newCount);
+
+  NSUInteger oldIndex = 0;
+  NSUInteger newIndex = 0;
+  while (oldIndex < oldCount && newIndex < newCount) {
+    const QDiffEntry *left = &oldEntries[oldIndex];
+    const QDiffEntry *right = &newEntries[newIndex];
+
+    if (left->key < right->key) {
+      ++oldIndex;
+    } else if (left->key > right->key) {
+      ++newIndex;
+    } else if (   requireEqual
+               && ![oldRules[left->index] isEqual:newRules[right->index]]) {
+      // Hash collision -- skip the old rule and try the next.
+      ++oldIndex;
+    } else {
+      oldToNew[left->index] = right->index;
+      newToOld[right->index] = left->index;
+      ++oldIndex;
+      ++newIndex;
+    }
+  }
+
+  free(oldEntries);
+  free(newEntries);
+}
+
+
+@interface QSchemeDiff ()
+
+@property (copy, readwrite) NSIndexSet *insertedIndexes;
+@property (copy, readwrite) NSIndexSet *removedIndexes;
+@property (copy, readwrite) NSDictionary *movedIndexes;
+@property (copy, readwrite) NSDictionary *modifiedIndexes;
+
+@end
+
+
+@implementation QSchemeDiff
+
++ (QSchemeDiff *)diffFromScheme:(QScheme *)oldScheme toScheme:(QScheme *)newScheme
+{
+  NSArray *oldRules = oldScheme.rules ?: @[];
+  NSArray *newRules = newScheme.rules ?: @[];
+
+  if (   oldScheme.rulesHash == newScheme.rulesHash
+      && [oldRules isEqualToArray:newRules]) {
+    return [self diffFromRules:@[] toRules:@[]];
+  }
+
+  return [self diffFromRules:oldRules toRules:newRules];
+}
+
+
++ (QSchemeDiff *)diffFromRules:(NSArray *)oldRules toRules:(NSArray *)newRules
+{
+  NSUInteger oldCount = [oldRules count];
+  NSUInteger newCount = [newRules count];
+  NSUInteger *oldToNew = malloc(sizeof(NSUInteger) * MAX(oldCount, 1));
+  NSUInteger *newToOld = malloc(sizeof(NSUInteger) * MAX(newCount, 1));
+
+  for (NSUInteger index = 0; index < oldCount; ++index) {
+    oldToNew[index] = NSNotFound;
+  }
+
+  for (NSUInteger index = 0; index < newCount; ++index) {
+    newToOld[index] = NSNotFound;
+  }
+
+  // Most edits touch a handful of rules, so pair up the common prefix and
+  // suffix first.
+  NSUInteger prefix = 0;
+  NSUInteger shortest = MIN(oldCount, newCount);
+  while (prefix < shortest && [oldRules[prefix] isEqual:newRules[prefix]]) {
+    oldToNew[prefix] = prefix;
+    newToOld[prefix] = prefix;
+    ++prefix;
+  }
+
+  NSUInteger suffix = 0;
+  while (   suffix < shortest - prefix
+         && [oldRules[oldCount - suffix - 1]
+             isEqual:newRules[newCount - suffix - 1]]) {
+    oldToNew[oldCount - suffix - 1] = newCount - suffix - 1;
+    newToOld[newCount - suffix - 1] = oldCount - suffix - 1;
+    ++suffix;
+  }
+
+  if (prefix + suffix < MAX(oldCount, newCount)) {
+    pairRules(oldRules, newRules, oldToNew, newToOld, ^(QSchemeRule *rule) {
+      return rule.contentHash;
+    }, YES);
+
+    pairRules(oldRules, newRules, oldToNew, newToOld, ^(QSchemeRule *rule) {
+      return hashFinalize(hashString(Q_HASH_SEED, rule.name));
+    }, NO);
+
+    pairRules(oldRules, newRules, oldToNew, newToOld, ^(QSchemeRule *rule) {
+      uint64_t hash = Q_HASH_SEED;
+      for (NSString *selector in rule.selectors) {
+        hash = hashString(hash, selector);
+      }
+      return hashFinalize(hash);
+    }, NO);
+  }
+
+  NSMutableIndexSet *removed = [NSMutableIndexSet new];
+  NSMutableIndexSet *inserted = [NSMutableIndexSet new];
+  NSMutableDictionary *modified = [NSMutableDictionary dictionary];
+  NSMutableDictionary *moved = [NSMutableDictionary dictionary];
+
+  for (NSUInteger index = 0; index < oldCount; ++index) {
+    NSUInteger paired = oldToNew[index];
+    if (paired == NSNotFound) {
+      [removed addIndex:index];
+    } else if (![oldRules[index] isEqual:newRules[paired]]) {
+      modified[@(index)] = @(paired);
+    }
+  }
+
+  // Pairs that aren't part of the longest run still in their old relative
+  // order were moved.
+  NSUInteger *sequence = malloc(sizeof(NSUInteger) * MAX(newCount, 1));
+  BOOL *inOrder = calloc(MAX(newCount, 1), sizeof(BOOL));
+  NSUInteger pairCount = 0;
+
+  for (NSUInteger index = 0; index < newCount; ++index) {
+    if (newToOld[index] == NSNotFound) {
+      [inserted addIndex:index];
+    } else {
+      sequence[pairCount++] = newToOld[index];
+    }
+  }
+
+  markLongestIncreasing(sequence, pairCount, inOrder);
+
+  for (NSUInteger pair = 0; pair < pairCount; ++pair) {
+    if (!inOrder[pair]) {
+      NSUInteger oldIndex = sequence[pair];
+      moved[@(oldIndex)] = @(oldToNew[oldIndex]);
+    }
+  }
+
+  free(sequence);
+  free(inOrder);
+  free(oldToNew);
+  free(newToOld);
+
+  QSchemeDiff *diff = [self new];
+  diff.removedIndexes = removed;
+  diff.insertedIndexes = inserted;
+  diff.modifiedIndexes = modified;
+  diff.movedIndexes = moved;
+  return diff;
+}
+
+
+- (BOOL)isEmpty
+{
+  return
+       [self.insertedIndexes count] == 0
+    && [self.removedIndexes count] == 0
+    && [self.movedIndexes count] == 0
+    && [self.modifiedIndexes count] == 0;
+}
+
+@end
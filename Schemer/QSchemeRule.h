@@ -41,11 +41,18 @@ typedef NS_ENUM(uint32_t, QSchemeRuleFlags) {
 
 @interface QSchemeRule : NSObject <NSCopying>
 
-@property (copy) NSString *name;
-@property (copy) NSArray *selectors; // <NSString>
-@property (copy) NSColor *foreground;
-@property (copy) NSColor *background;
-@property NSNumber *flags;
+@property (copy, nonatomic) NSString *name;
+@property (copy, nonatomic) NSArray *selectors; // <NSString>
+@property (copy, nonatomic) NSColor *foreground;
+@property (copy, nonatomic) NSColor *background;
+@property (strong, nonatomic) NSNumber *flags;
+
+// Hash of the rule's name, selectors, colors (as serialized), and flags.
+// Cached until one of those properties is set, which also tells the scheme
+// hashing the rule (see -[QScheme rulesHash]) which leaf to rehash. Rules with
+// equal content hashes are almost certainly -isEqual:, which compares the same
+// fields.
+@property (readonly) uint64_t contentHash;
 
 - (id)init;
 - (id)initWithPropertyList:(NSDictionary *)plist;
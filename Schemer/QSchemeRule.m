@@ -29,6 +29,7 @@
 /* QSchemeRule.m - Noel Cower */
 
 #import "QSchemeRule.h"
+#import "QScheme.h"
 #import "NSFilters.h"
 #import "NSColor+QHexColor.h"
 #import "aux.h"
@@ -85,14 +86,59 @@ schemeFlagStringForFlags(uint32_t flags)
 }
 
 
-@implementation QSchemeRule
+// Colors are immutable, so every new rule can share the same defaults.
+static
+NSColor *
+defaultForeground()
+{
+  static NSColor *color = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    color = [NSColor colorWithWhite:0.0f alpha:0.0f];
+  });
+  return color;
+}
+
+
+static
+NSColor *
+defaultBackground()
+{
+  static NSColor *color = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    color = [NSColor colorWithWhite:1.0f alpha:0.0f];
+  });
+  return color;
+}
+
+
+#pragma mark Private API for QScheme
+
+@interface QScheme (QRulesHashTree)
+
+- (void)ruleDidChangeAtLeaf:(NSUInteger)leaf;
+
+@end
+
+
+#pragma mark Implementation
+
+@implementation QSchemeRule {
+  uint64_t _contentHash;
+  BOOL _hasContentHash;
+  // Scheme whose rules hash tree has this rule as a leaf, if any. Not retained:
+  // the scheme detaches its rules before it goes away.
+  __unsafe_unretained QScheme *_hashTree;
+  NSUInteger _hashLeaf;
+}
 
 - (id)init {
   if ((self = [super init])) {
     self.name       = @"Unnamed Rule";
     self.selectors  = @[];
-    self.foreground = [NSColor colorWithWhite:0.0f alpha:0.0f];
-    self.background = [NSColor colorWithWhite:1.0f alpha:0.0f];
+    self.foreground = defaultForeground();
+    self.background = defaultBackground();
     self.flags      = @(QNoFlags);
   }
   return self;
@@ -112,6 +158,99 @@ schemeFlagStringForFlags(uint32_t flags)
 }
 
 
+- (void)setName:(NSString *)name
+{
+  _name = [name copy];
+  [self contentDidChange];
+}
+
+
+- (void)setSelectors:(NSArray *)selectors
+{
+  _selectors = [selectors copy];
+  [self contentDidChange];
+}
+
+
+- (void)setForeground:(NSColor *)foreground
+{
+  _foreground = [foreground copy];
+  [self contentDidChange];
+}
+
+
+- (void)setBackground:(NSColor *)background
+{
+  _background = [background copy];
+  [self contentDidChange];
+}
+
+
+- (void)setFlags:(NSNumber *)flags
+{
+  _flags = flags;
+  [self contentDidChange];
+}
+
+
+- (void)contentDidChange
+{
+  _hasContentHash = NO;
+  [_hashTree ruleDidChangeAtLeaf:_hashLeaf];
+}
+
+
+// Used by rules backed by a snapshot (see QScheme+QSnapshot.m), whose content
+// hash is stored alongside their fields. Primes the cached hash, which stays
+// valid until a setter is called.
+- (void)primeContentHash:(uint64_t)contentHash
+{
+  _contentHash    = contentHash;
+  _hasContentHash = YES;
+}
+
+
+// Also for snapshot-backed rules: fills in fields decoded from the snapshot.
+// The content doesn't change, so this neither invalidates the cached hash nor
+// reports a change.
+- (void)
+  restoreName:(NSString *)name
+    selectors:(NSArray *)selectors
+   foreground:(NSColor *)foreground
+   background:(NSColor *)background
+        flags:(NSNumber *)flags
+{
+  _name       = [name copy];
+  _selectors  = [selectors copy];
+  _foreground = [foreground copy];
+  _background = [background copy];
+  _flags      = flags;
+}
+
+
+// Called by QScheme as it builds its rules hash tree. A rule can only report
+// to one tree, so this fails if the rule is already a leaf of any tree,
+// including another leaf of the same one.
+- (BOOL)attachToHashTree:(QScheme *)scheme leaf:(NSUInteger)leaf
+{
+  if (_hashTree) {
+    return NO;
+  }
+
+  _hashTree = scheme;
+  _hashLeaf = leaf;
+  return YES;
+}
+
+
+- (void)detachFromHashTree:(QScheme *)scheme
+{
+  if (_hashTree == scheme) {
+    _hashTree = nil;
+  }
+}
+
+
 - (id)copyWithZone:(NSZone *)zone
 {
   return [[self.class alloc] initWithRule:self];
@@ -147,6 +286,64 @@ schemeFlagStringForFlags(uint32_t flags)
 }
 
 
+- (uint64_t)contentHash
+{
+  if (_hasContentHash) {
+    return _contentHash;
+  }
+
+  uint64_t hash = hashString(Q_HASH_SEED, _name);
+
+  hash = hashUInt64(hash, [_selectors count]);
+  for (NSString *selector in _selectors) {
+    hash = hashString(hash, selector);
+  }
+
+  hash = hashUInt64(hash, [_foreground toPackedRGBA]);
+  hash = hashUInt64(hash, [_background toPackedRGBA]);
+  hash = hashUInt64(hash, _flags.unsignedIntValue);
+
+  _contentHash    = hashFinalize(hash);
+  _hasContentHash = YES;
+
+  return _contentHash;
+}
+
+
+- (BOOL)isEqual:(id)object
+{
+  if (object == self) {
+    return YES;
+  } else if (![object isKindOfClass:[QSchemeRule class]]) {
+    return NO;
+  }
+
+  QSchemeRule *other = (QSchemeRule *)object;
+
+  if (self.contentHash != other.contentHash) {
+    return NO;
+  }
+
+  NSString *name = self.name;
+  NSString *otherName = other.name;
+  NSArray *selectors = self.selectors;
+  NSArray *otherSelectors = other.selectors;
+
+  return
+       (name == otherName || [name isEqualToString:otherName])
+    && (selectors == otherSelectors || [selectors isEqualToArray:otherSelectors])
+    && [self.foreground toPackedRGBA] == [other.foreground toPackedRGBA]
+    && [self.background toPackedRGBA] == [other.background toPackedRGBA]
+    && self.flags.unsignedIntValue == other.flags.unsignedIntValue;
+}
+
+
+- (NSUInteger)hash
+{
+  return (NSUInteger)self.contentHash;
+}
+
+
 - (NSDictionary *)toPropertyList
 {
   NSMutableDictionary *plist = [NSMutableDictionary new];
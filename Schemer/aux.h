@@ -58,4 +58,41 @@ void
 putColorIfVisible(NSMutableDictionary *plist, NSString *key, NSColor *color);
 
 
+// Content hashing. Hashes are built up by passing the running hash back in,
+// starting from Q_HASH_SEED, and should be passed through hashFinalize before
+// being compared or stored.
+#define Q_HASH_SEED (0xCBF29CE484222325ULL)
+
+
+uint64_t
+hashBytes(uint64_t hash, const void *bytes, size_t length);
+
+
+uint64_t
+hashUInt64(uint64_t hash, uint64_t value);
+
+
+uint64_t
+hashString(uint64_t hash, NSString *string);
+
+
+uint64_t
+hashFinalize(uint64_t hash);
+
+
+uint64_t
+hashPair(uint64_t left, uint64_t right);
+
+
+// Sets marks[i] for each element of sequence, whose values must be distinct,
+// that is part of its longest increasing subsequence. Elements left unmarked
+// are the fewest that have to move to put the sequence in order.
+void
+markLongestIncreasing(
+  const NSUInteger *sequence,
+  NSUInteger count,
+  BOOL *marks
+  );
+
+
 #endif
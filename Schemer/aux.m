@@ -85,3 +85,109 @@ putColorIfVisible(NSMutableDictionary *plist, NSString *key, NSColor *color)
     plist[key] = [color toHexColorString];
   }
 }
+
+
+uint64_t
+hashBytes(uint64_t hash, const void *bytes, size_t length)
+{
+  // FNV-1a
+  const uint8_t *cursor = (const uint8_t *)bytes;
+  const uint8_t *end = cursor + length;
+  for (; cursor < end; ++cursor) {
+    hash ^= *cursor;
+    hash *= 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+
+uint64_t
+hashUInt64(uint64_t hash, uint64_t value)
+{
+  return hashBytes(hash, &value, sizeof(value));
+}
+
+
+uint64_t
+hashString(uint64_t hash, NSString *string)
+{
+  if (!string) {
+    // Distinguishes nil from the empty string.
+    return hashUInt64(hash, UINT64_MAX);
+  }
+
+  CFStringRef cfString = (__bridge CFStringRef)string;
+  const char *utf8 = CFStringGetCStringPtr(cfString, kCFStringEncodingUTF8);
+  if (!utf8) {
+    utf8 = [string UTF8String];
+  }
+
+  size_t length = strlen(utf8);
+  hash = hashUInt64(hash, length);
+  return hashBytes(hash, utf8, length);
+}
+
+
+uint64_t
+hashFinalize(uint64_t hash)
+{
+  // splitmix64 finalizer, since FNV alone mixes the high bits poorly.
+  hash ^= hash >> 30;
+  hash *= 0xBF58476D1CE4E5B9ULL;
+  hash ^= hash >> 27;
+  hash *= 0x94D049BB133111EBULL;
+  hash ^= hash >> 31;
+  return hash;
+}
+
+
+uint64_t
+hashPair(uint64_t left, uint64_t right)
+{
+  return hashFinalize(hashUInt64(hashUInt64(Q_HASH_SEED, left), right));
+}
+
+
+void
+markLongestIncreasing(
+  const NSUInteger *sequence,
+  NSUInteger count,
+  BOOL *marks
+  )
+{
+  if (count == 0) {
+    return;
+  }
+
+  NSUInteger *tails = malloc(sizeof(NSUInteger) * count);
+  NSUInteger *previous = malloc(sizeof(NSUInteger) * count);
+  NSUInteger length = 0;
+
+  for (NSUInteger index = 0; index < count; ++index) {
+    NSUInteger low = 0;
+    NSUInteger high = length;
+    while (low < high) {
+      NSUInteger mid = (low + high) / 2;
+      if (sequence[tails[mid]] < sequence[index]) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+
+    previous[index] = low > 0 ? tails[low - 1] : NSNotFound;
+    tails[low] = index;
+    if (low == length) {
+      ++length;
+    }
+  }
+
+  for (NSUInteger index = tails[length - 1];
+       index != NSNotFound;
+       index = previous[index]) {
+    marks[index] = YES;
+  }
+
+  free(tails);
+  free(previous);
+}
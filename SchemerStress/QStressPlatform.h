@@ -0,0 +1,73 @@
+/*===========================================================================
+  Copyright (c) 2014, Noel Cower.
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+  IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================*/
+
+/* QStressPlatform.h (SchemerStress) - Noel Cower */
+
+#ifndef SchemerStress_QStressPlatform_h
+#define SchemerStress_QStressPlatform_h
+
+#import <Foundation/Foundation.h>
+
+
+/*
+Everything the stress harness needs from the OS to measure time and memory.
+These are the only Darwin-specific parts of the harness: mach_absolute_time,
+malloc_zone_statistics, and the private but exported malloc_logger hook
+libmalloc calls for every allocation. Porting the harness means porting this
+file.
+*/
+
+
+typedef struct {
+  uint64_t bytes;
+  uint64_t blocks;
+} QStressHeapUsage;
+
+
+// Monotonic time in nanoseconds, for measuring intervals.
+uint64_t
+stressNanoseconds(void);
+
+
+// Bytes and blocks currently allocated, summed over every malloc zone.
+QStressHeapUsage
+stressHeapUsage(void);
+
+
+// Returns the number of allocations made, in any zone, while running block.
+// Unlike stressHeapUsage, this includes anything allocated and freed again.
+uint64_t
+stressCountAllocations(void (^block)(void));
+
+
+// Largest resident set size the process has had so far, in bytes.
+uint64_t
+stressPeakResidentBytes(void);
+
+
+#endif
@@ -0,0 +1,116 @@
+/*===========================================================================
+  Copyright (c) 2014, Noel Cower.
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+  IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================*/
+
+/* QStressPlatform.m (SchemerStress) - Noel Cower */
+
+#import "QStressPlatform.h"
+
+#import <mach/mach_time.h>
+#import <malloc/malloc.h>
+#import <sys/resource.h>
+
+
+// libmalloc calls malloc_logger, if set, for every allocation and free in
+// every zone. It isn't declared in the public headers, but it's exported and
+// is what MallocStackLogging hooks into.
+typedef void (malloc_logger_t)(
+  uint32_t type,
+  uintptr_t arg1,
+  uintptr_t arg2,
+  uintptr_t arg3,
+  uintptr_t result,
+  uint32_t numHotFramesToSkip
+  );
+extern malloc_logger_t *malloc_logger;
+
+#define Q_MALLOC_LOG_TYPE_ALLOCATE (2)
+
+
+static uint64_t g_allocationCount = 0;
+
+
+uint64_t
+stressNanoseconds(void)
+{
+  static mach_timebase_info_data_t timebase;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    mach_timebase_info(&timebase);
+  });
+  return mach_absolute_time() * timebase.numer / timebase.denom;
+}
+
+
+QStressHeapUsage
+stressHeapUsage(void)
+{
+  malloc_statistics_t stats = { 0 };
+  malloc_zone_statistics(NULL, &stats);
+  return (QStressHeapUsage){ stats.size_in_use, stats.blocks_in_use };
+}
+
+
+static
+void
+countAllocation(
+  uint32_t type,
+  uintptr_t arg1,
+  uintptr_t arg2,
+  uintptr_t arg3,
+  uintptr_t result,
+  uint32_t numHotFramesToSkip
+  )
+{
+  // Reallocations are logged as an allocate and a deallocate, and count.
+  if (type & Q_MALLOC_LOG_TYPE_ALLOCATE) {
+    __atomic_fetch_add(&g_allocationCount, 1, __ATOMIC_RELAXED);
+  }
+}
+
+
+uint64_t
+stressCountAllocations(void (^block)(void))
+{
+  __atomic_store_n(&g_allocationCount, 0, __ATOMIC_RELAXED);
+  malloc_logger = countAllocation;
+  block();
+  malloc_logger = NULL;
+  return __atomic_load_n(&g_allocationCount, __ATOMIC_RELAXED);
+}
+
+
+uint64_t
+stressPeakResidentBytes(void)
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  // ru_maxrss is in bytes on Darwin.
+  return (uint64_t)usage.ru_maxrss;
+}
@@ -0,0 +1,944 @@
+/*===========================================================================
+  Copyright (c) 2014, Noel Cower.
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+  IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================*/
+
+/* main.m (SchemerStress) - Noel Cower */
+
+#import <Cocoa/Cocoa.h>
+
+#import "QDocument.h"
+#import "QPreviewController.h"
+#import "QPreviewSource.h"
+#import "QScheme.h"
+#import "QScheme+QJSON.h"
+#import "QScheme+QSnapshot.h"
+#import "QSchemeRule.h"
+#import "QStressPlatform.h"
+
+
+/*
+SchemerStress drives a headless QDocument through the same operations the UI
+performs -- load, rule append/remove, color changes, selector append/remove,
+copying via -initWithScheme: and saving, as both .tmTheme and
+.sublime-color-scheme -- against synthetic themes of increasing size. Rules
+and selectors are added and removed through the QDocument methods the add and
+remove buttons call, so only the table updates are left out. Latency
+samples, retained heap per rule and peak RSS are checked against
+StressBudgets.plist and the tool exits non-zero if any budget is exceeded.
+Operations may also be budgeted relative to another operation, e.g. loadJSON's
+p50 against load's. Both are timed opening the document the way the app does,
+with snapshot caching off; loadSnapshot times the same open from a snapshot.
+
+A separate preview scenario styles a large sample (the bundled preview sample
+repeated out to previewLines lines) with a previewRules-rule theme and times
+how long rule edits take to reach the preview.
+
+Heap usage for loads is reported two ways: bytes and blocks still live once
+the document is loaded, and allocations made during the load, which also
+catches allocations that were freed again. Timing and memory measurements all
+go through QStressPlatform.h.
+
+Options are read through NSUserDefaults, so they're passed as e.g.
+`-budgets path/to/StressBudgets.plist -sizes 1000,20000 -output out.plist`.
+`-record path` writes a copy of the budgets file with every absolute budget
+replaced by the worst value measured in this run times
+QStressRecordHeadroom, which is how StressBudgets.plist is meant to be
+rebaselined. Relative budgets are copied as they are.
+*/
+
+
+static NSString *const QStressThemeType = @"tmTheme";
+static NSString *const QStressJSONType = @"sublime-color-scheme";
+
+// Number of samples taken for each edit operation per theme size.
+static const NSUInteger QStressEditBurst = 256;
+
+// Number of samples taken for load/copy/save per theme size.
+static const NSUInteger QStressBulkRepeats = 5;
+
+// Slack given to each budget written by -record over the measured value.
+static const double QStressRecordHeadroom = 1.5;
+
+
+typedef struct {
+  uint64_t *samples;
+  NSUInteger count;
+  NSUInteger capacity;
+} QStressSamples;
+
+
+static uint64_t g_randomState = 0x9E3779B97F4A7C15ULL;
+
+
+static
+uint64_t
+nextRandom()
+{
+  // xorshift64* -- deterministic so runs are comparable.
+  uint64_t x = g_randomState;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  g_randomState = x;
+  return x * 0x2545F4914F6CDD1DULL;
+}
+
+
+static
+NSUInteger
+randomBelow(NSUInteger bound)
+{
+  return bound ? (NSUInteger)(nextRandom() % bound) : 0;
+}
+
+
+static
+NSColor *
+randomColor()
+{
+  uint64_t bits = nextRandom();
+  return [NSColor colorWithDeviceRed:((bits >> 0) & 0xFF) / 255.0
+                               green:((bits >> 8) & 0xFF) / 255.0
+                                blue:((bits >> 16) & 0xFF) / 255.0
+                               alpha:((bits >> 24) & 0x1) ? 1.0 : 0.5];
+}
+
+
+static
+NSArray *
+scopeVocabulary()
+{
+  static NSArray *words = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    words = @[
+      @"comment", @"constant", @"entity", @"invalid", @"keyword", @"markup",
+      @"meta", @"storage", @"string", @"support", @"variable", @"punctuation",
+      @"numeric", @"language", @"character", @"escape", @"name", @"function",
+      @"class", @"tag", @"attribute", @"control", @"operator", @"type",
+      @"modifier", @"quoted", @"double", @"single", @"regexp", @"other",
+      @"line", @"block", @"definition", @"parameter", @"source", @"text"
+    ];
+  });
+  return words;
+}
+
+
+static
+NSString *
+randomScope()
+{
+  NSArray *words = scopeVocabulary();
+  NSUInteger depth = 2 + randomBelow(3);
+  NSMutableArray *parts = [NSMutableArray arrayWithCapacity:depth];
+  for (NSUInteger part = 0; part < depth; ++part) {
+    [parts addObject:words[randomBelow([words count])]];
+  }
+  return [parts componentsJoinedByString:@"."];
+}
+
+
+static
+QSchemeRule *
+randomRule(NSUInteger index)
+{
+  QSchemeRule *rule = [QSchemeRule new];
+  NSUInteger selectorCount = 1 + randomBelow(4);
+  NSMutableArray *selectors = [NSMutableArray arrayWithCapacity:selectorCount];
+
+  for (NSUInteger sel = 0; sel < selectorCount; ++sel) {
+    [selectors addObject:randomScope()];
+  }
+
+  rule.name       = [NSString stringWithFormat:@"Rule %lu", (unsigned long)index];
+  rule.selectors  = selectors;
+  rule.foreground = randomColor();
+
+  if (randomBelow(4) == 0) {
+    rule.background = randomColor();
+  }
+
+  rule.flags = @(randomBelow(8));
+  return rule;
+}
+
+
+static
+QScheme *
+syntheticScheme(NSUInteger ruleCount)
+{
+  QScheme *scheme = [QScheme new];
+  NSMutableArray *rules = [NSMutableArray arrayWithCapacity:ruleCount];
+
+  for (NSUInteger index = 0; index < ruleCount; ++index) {
+    [rules addObject:randomRule(index)];
+  }
+
+  scheme.foregroundColor = [randomColor() colorWithAlphaComponent:1.0];
+  scheme.backgroundColor = [randomColor() colorWithAlphaComponent:1.0];
+  scheme.rules = rules;
+  return scheme;
+}
+
+
+#pragma mark Measurement
+
+static
+void
+addSample(QStressSamples *samples, uint64_t nanos)
+{
+  if (samples->count == samples->capacity) {
+    samples->capacity = samples->capacity ? samples->capacity * 2 : 64;
+    samples->samples =
+      reallocf(samples->samples, samples->capacity * sizeof(uint64_t));
+  }
+  samples->samples[samples->count++] = nanos;
+}
+
+
+static
+int
+compareSamples(const void *lhs, const void *rhs)
+{
+  uint64_t left = *(const uint64_t *)lhs;
+  uint64_t right = *(const uint64_t *)rhs;
+  return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+
+static
+uint64_t
+samplePercentile(QStressSamples *samples, double percentile)
+{
+  if (samples->count == 0) {
+    return 0;
+  }
+
+  qsort(samples->samples, samples->count, sizeof(uint64_t), compareSamples);
+  NSUInteger rank = (NSUInteger)(percentile * (samples->count - 1) + 0.5);
+  return samples->samples[rank];
+}
+
+
+static
+void
+measure(QStressSamples *samples, void (^block)(void))
+{
+  uint64_t start = stressNanoseconds();
+  block();
+  addSample(samples, stressNanoseconds() - start);
+}
+
+
+#pragma mark Scenario
+
+// Opens a document the way NSDocumentController does.
+static
+QDocument *
+openDocument(NSURL *url, NSString *type)
+{
+  NSError *error = nil;
+  QDocument *document = [[QDocument alloc] initWithContentsOfURL:url
+                                                          ofType:type
+                                                           error:&error];
+  if (!document) {
+    NSLog(@"Unable to load %@: %@", url, error);
+  }
+  return document;
+}
+
+
+static
+NSArray *
+operationNames()
+{
+  return @[
+    @"load",
+    @"loadSnapshot",
+    @"loadJSON",
+    @"copy",
+    @"save",
+    @"saveJSON",
+    @"appendRule",
+    @"removeRule",
+    @"changeColor",
+    @"appendSelector",
+    @"removeSelector"
+  ];
+}
+
+
+static
+NSDictionary *
+runScenario(NSUInteger ruleCount, NSURL *scratchURL, NSURL *jsonURL)
+{
+  NSMutableDictionary *samples = [NSMutableDictionary dictionary];
+  NSMutableDictionary *result = [NSMutableDictionary dictionary];
+
+  for (NSString *op in operationNames()) {
+    samples[op] = [NSMutableData dataWithLength:sizeof(QStressSamples)];
+  }
+
+  QStressSamples *(^samplesFor)(NSString *) = ^(NSString *op) {
+    return (QStressSamples *)[samples[op] mutableBytes];
+  };
+
+  @autoreleasepool {
+    QScheme *synthetic = syntheticScheme(ruleCount);
+    [[synthetic toPropertyList] writeToURL:scratchURL atomically:NO];
+    [[synthetic toJSONDataWithName:@"Stress"] writeToURL:jsonURL atomically:NO];
+  }
+
+  __block QDocument *document = nil;
+  __block NSError *error = nil;
+
+  // Loads are timed with snapshots off so that load and loadJSON go through
+  // exactly the same path, parsing the file and nothing else, and neither
+  // pays for the allocation hook. Their repeats are interleaved so both see
+  // the same machine state.
+  [QDocument setCachesSnapshots:NO];
+
+  for (NSUInteger repeat = 0; repeat < QStressBulkRepeats; ++repeat) {
+    @autoreleasepool {
+      __block QDocument *loaded = nil;
+      measure(samplesFor(@"load"), ^{
+        loaded = openDocument(scratchURL, QStressThemeType);
+      });
+      loaded = nil;
+
+      measure(samplesFor(@"loadJSON"), ^{
+        loaded = openDocument(jsonURL, QStressJSONType);
+      });
+      loaded = nil;
+    }
+  }
+
+  // Heap usage and allocations are measured in a pass of their own. The
+  // document is opened the way the app opens it, so it has a file URL and the
+  // edits below pay for its change tracking.
+  QStressHeapUsage heapBefore = stressHeapUsage();
+  uint64_t loadAllocations = stressCountAllocations(^{
+    @autoreleasepool {
+      document = openDocument(scratchURL, QStressThemeType);
+    }
+  });
+  QStressHeapUsage heapAfter = stressHeapUsage();
+
+  // Reopening from a snapshot written from what's in the file, as a cold open
+  // would leave behind.
+  [QDocument setCachesSnapshots:YES];
+  if (![document.scheme writeSnapshotForURL:scratchURL error:&error]) {
+    NSLog(@"Unable to write snapshot for %@: %@", scratchURL, error);
+  }
+
+  // Snapshot rules are backed by the mapped file, so reading one in should
+  // cost about one allocation per rule, whatever is in the rules.
+  uint64_t snapshotAllocations = stressCountAllocations(^{
+    @autoreleasepool {
+      QScheme *snapshot = [[QScheme alloc] initWithSnapshotOfURL:scratchURL];
+      if (snapshot == nil) {
+        NSLog(@"Unable to read snapshot of %@", scratchURL);
+      }
+    }
+  });
+
+  for (NSUInteger repeat = 0; repeat < QStressBulkRepeats; ++repeat) {
+    @autoreleasepool {
+      __block QDocument *snapshotDocument = nil;
+      measure(samplesFor(@"loadSnapshot"), ^{
+        snapshotDocument = openDocument(scratchURL, QStressThemeType);
+      });
+      snapshotDocument = nil;
+    }
+  }
+
+  [[NSFileManager defaultManager]
+   removeItemAtURL:[QScheme snapshotURLForURL:scratchURL] error:NULL];
+  [QDocument setCachesSnapshots:NO];
+
+  QScheme *scheme = document.scheme;
+
+  for (NSUInteger repeat = 0; repeat < QStressBulkRepeats; ++repeat) {
+    @autoreleasepool {
+      __block QScheme *copy = nil;
+      measure(samplesFor(@"copy"), ^{
+        copy = [[QScheme alloc] initWithScheme:scheme];
+      });
+      copy = nil;
+    }
+  }
+
+  for (NSUInteger burst = 0; burst < QStressEditBurst; ++burst) {
+    @autoreleasepool {
+      measure(samplesFor(@"appendRule"), ^{
+        [document appendRule:[QSchemeRule new]];
+      });
+
+      NSIndexSet *victim =
+        [NSIndexSet indexSetWithIndex:randomBelow([scheme.rules count])];
+      measure(samplesFor(@"removeRule"), ^{
+        [document removeRulesAtIndexes:victim];
+      });
+
+      QSchemeRule *rule = scheme.rules[randomBelow([scheme.rules count])];
+      NSColor *color = randomColor();
+      measure(samplesFor(@"changeColor"), ^{
+        rule.foreground = color;
+      });
+
+      __block NSUInteger appended = 0;
+      measure(samplesFor(@"appendSelector"), ^{
+        appended = [document appendSelector:@"scope" toRule:rule];
+      });
+
+      NSIndexSet *selector = [NSIndexSet indexSetWithIndex:appended];
+      measure(samplesFor(@"removeSelector"), ^{
+        [document removeSelectorsAtIndexes:selector fromRule:rule];
+      });
+    }
+  }
+
+  for (NSUInteger repeat = 0; repeat < QStressBulkRepeats; ++repeat) {
+    @autoreleasepool {
+      measure(samplesFor(@"save"), ^{
+        if (![document writeToURL:scratchURL
+                           ofType:QStressThemeType
+                            error:&error]) {
+          NSLog(@"Unable to save %@: %@", scratchURL, error);
+        }
+      });
+
+      measure(samplesFor(@"saveJSON"), ^{
+        if (![document writeToURL:jsonURL
+                           ofType:QStressJSONType
+                            error:&error]) {
+          NSLog(@"Unable to save %@: %@", jsonURL, error);
+        }
+      });
+    }
+  }
+
+  NSMutableDictionary *operations = [NSMutableDictionary dictionary];
+  for (NSString *op in operationNames()) {
+    QStressSamples *opSamples = samplesFor(op);
+    operations[op] = @{
+      @"p50": @(samplePercentile(opSamples, 0.50)),
+      @"p99": @(samplePercentile(opSamples, 0.99)),
+      @"samples": @(opSamples->count)
+    };
+    free(opSamples->samples);
+  }
+
+  double heapBytes = (double)heapAfter.bytes - heapBefore.bytes;
+  double heapBlocks = (double)heapAfter.blocks - heapBefore.blocks;
+
+  result[@"rules"]                 = @(ruleCount);
+  result[@"operations"]            = operations;
+  result[@"operationNames"]        = operationNames();
+  result[@"bytesPerRule"]          = @(heapBytes / ruleCount);
+  result[@"retainedBlocksPerRule"] = @(heapBlocks / ruleCount);
+  result[@"allocationsPerRule"]    = @((double)loadAllocations / ruleCount);
+  result[@"snapshotAllocationsPerRule"] =
+    @((double)snapshotAllocations / ruleCount);
+  result[@"peakRSS"]               = @(stressPeakResidentBytes());
+
+  document = nil;
+  return result;
+}
+
+
+#pragma mark Preview scenario
+
+static
+NSArray *
+previewOperationNames()
+{
+  return @[
+    @"previewAppendRule",
+    @"previewRemoveRule",
+    @"previewMoveRule",
+    @"previewChangeColor"
+  ];
+}
+
+
+static
+QPreviewSource *
+largePreviewSource(NSUInteger lineCount)
+{
+  NSString *sample = [QPreviewSource bundledSample].text;
+  NSUInteger sampleLines =
+    MAX([[sample componentsSeparatedByString:@"\n"] count], 1);
+  NSUInteger copies = (lineCount + sampleLines - 1) / sampleLines;
+  NSMutableString *text =
+    [NSMutableString stringWithCapacity:[sample length] * copies];
+
+  for (NSUInteger copy = 0; copy < copies; ++copy) {
+    [text appendString:sample];
+  }
+
+  return [[QPreviewSource alloc] initWithCSource:text];
+}
+
+
+// A rule whose selectors come from the preview's own scope stacks -- a scope
+// or a prefix of one, or an ancestor and descendant from the same stack -- so
+// that rules actually win scopes, including the root, and edits to them change
+// what the preview shows.
+static
+QSchemeRule *
+previewRule(QPreviewSource *source, NSUInteger index)
+{
+  QSchemeRule *rule = randomRule(index);
+  NSArray *stacks = source.scopes;
+  NSUInteger selectorCount = 1 + randomBelow(3);
+  NSMutableArray *selectors = [NSMutableArray arrayWithCapacity:selectorCount];
+
+  for (NSUInteger sel = 0; sel < selectorCount; ++sel) {
+    NSArray *stack = stacks[randomBelow([stacks count])];
+    NSUInteger depth = [stack count];
+
+    if (depth > 1 && randomBelow(4) == 0) {
+      NSUInteger ancestor = randomBelow(depth - 1);
+      NSUInteger descendant = ancestor + 1 + randomBelow(depth - ancestor - 1);
+      [selectors addObject:[NSString stringWithFormat:@"%@ %@",
+                            stack[ancestor], stack[descendant]]];
+    } else {
+      NSArray *segments =
+        [stack[randomBelow(depth)] componentsSeparatedByString:@"."];
+      NSRange prefix = NSMakeRange(0, 1 + randomBelow([segments count]));
+      [selectors addObject:
+       [[segments subarrayWithRange:prefix] componentsJoinedByString:@"."]];
+    }
+  }
+
+  rule.selectors = selectors;
+  return rule;
+}
+
+
+static
+QScheme *
+previewScheme(QPreviewSource *source, NSUInteger ruleCount)
+{
+  QScheme *scheme = syntheticScheme(0);
+  NSMutableArray *rules = [NSMutableArray arrayWithCapacity:ruleCount];
+
+  for (NSUInteger index = 0; index < ruleCount; ++index) {
+    [rules addObject:previewRule(source, index)];
+  }
+
+  scheme.rules = rules;
+  return scheme;
+}
+
+
+static
+NSDictionary *
+runPreviewScenario(NSUInteger ruleCount, NSUInteger lineCount)
+{
+  NSMutableDictionary *samples = [NSMutableDictionary dictionary];
+  for (NSString *op in previewOperationNames()) {
+    samples[op] = [NSMutableData dataWithLength:sizeof(QStressSamples)];
+  }
+
+  QStressSamples *(^samplesFor)(NSString *) = ^(NSString *op) {
+    return (QStressSamples *)[samples[op] mutableBytes];
+  };
+
+  QPreviewSource *source = largePreviewSource(lineCount);
+  QScheme *scheme = previewScheme(source, ruleCount);
+  QPreviewController *preview =
+    [[QPreviewController alloc] initWithScheme:scheme source:source];
+
+  // Each sample covers the model change plus the preview catching up, i.e.
+  // what has to fit in a frame. Since later rules win ties, the last rule is
+  // usually winning something: alternate bursts edit it, so winners are
+  // removed, moved away, and recolored, and the others edit a random rule,
+  // which usually isn't winning anything.
+  for (NSUInteger burst = 0; burst < QStressEditBurst; ++burst) {
+    @autoreleasepool {
+      BOOL editWinner = (burst % 2) == 0;
+      QSchemeRule *appended = previewRule(source, ruleCount + burst);
+      measure(samplesFor(@"previewAppendRule"), ^{
+        scheme.rules = [scheme.rules arrayByAddingObject:appended];
+        [preview rulesDidChange];
+        [preview flushPendingChanges];
+      });
+
+      NSUInteger victim = editWinner
+        ? [scheme.rules count] - 1
+        : randomBelow([scheme.rules count]);
+      measure(samplesFor(@"previewRemoveRule"), ^{
+        NSMutableArray *rules = [scheme.rules mutableCopy];
+        [rules removeObjectAtIndex:victim];
+        scheme.rules = rules;
+        [preview rulesDidChange];
+        [preview flushPendingChanges];
+      });
+
+      // Either the last rule moves away or a random rule moves to the end,
+      // where it wins its ties.
+      NSUInteger last = [scheme.rules count] - 1;
+      NSUInteger from = editWinner ? last : randomBelow(last + 1);
+      NSUInteger to = editWinner ? randomBelow(last + 1) : last;
+      measure(samplesFor(@"previewMoveRule"), ^{
+        NSMutableArray *rules = [scheme.rules mutableCopy];
+        QSchemeRule *moved = rules[from];
+        [rules removeObjectAtIndex:from];
+        [rules insertObject:moved atIndex:to];
+        scheme.rules = rules;
+        [preview rulesDidChange];
+        [preview flushPendingChanges];
+      });
+
+      QSchemeRule *rule = editWinner
+        ? [scheme.rules lastObject]
+        : scheme.rules[randomBelow([scheme.rules count])];
+      NSColor *color = randomColor();
+      measure(samplesFor(@"previewChangeColor"), ^{
+        rule.foreground = color;
+        [preview rule:rule didChangeKeyPath:@"foreground"];
+        [preview flushPendingChanges];
+      });
+    }
+  }
+
+  NSMutableDictionary *operations = [NSMutableDictionary dictionary];
+  for (NSString *op in previewOperationNames()) {
+    QStressSamples *opSamples = samplesFor(op);
+    operations[op] = @{
+      @"p50": @(samplePercentile(opSamples, 0.50)),
+      @"p99": @(samplePercentile(opSamples, 0.99)),
+      @"samples": @(opSamples->count)
+    };
+    free(opSamples->samples);
+  }
+
+  return @{
+    @"rules": @(ruleCount),
+    @"lines": @(lineCount),
+    @"operations": operations,
+    @"operationNames": previewOperationNames()
+  };
+}
+
+
+#pragma mark Budgets
+
+static
+NSArray *
+checkBudgets(NSDictionary *run, NSDictionary *budgets)
+{
+  NSMutableArray *failures = [NSMutableArray array];
+  NSUInteger rules = [run[@"rules"] unsignedIntegerValue];
+
+  double bytesPerRule = [run[@"bytesPerRule"] doubleValue];
+  NSNumber *maxBytes = budgets[@"maxBytesPerRule"];
+  if (maxBytes && bytesPerRule > maxBytes.doubleValue) {
+    [failures addObject:
+     [NSString stringWithFormat:@"%lu rules: %.1f bytes/rule > %@",
+      (unsigned long)rules, bytesPerRule, maxBytes]];
+  }
+
+  double blocksPerRule = [run[@"retainedBlocksPerRule"] doubleValue];
+  NSNumber *maxBlocks = budgets[@"maxRetainedBlocksPerRule"];
+  if (maxBlocks && blocksPerRule > maxBlocks.doubleValue) {
+    [failures addObject:
+     [NSString stringWithFormat:@"%lu rules: %.1f retained blocks/rule > %@",
+      (unsigned long)rules, blocksPerRule, maxBlocks]];
+  }
+
+  double allocsPerRule = [run[@"allocationsPerRule"] doubleValue];
+  NSNumber *maxAllocs = budgets[@"maxAllocationsPerRule"];
+  if (maxAllocs && allocsPerRule > maxAllocs.doubleValue) {
+    [failures addObject:
+     [NSString stringWithFormat:@"%lu rules: %.1f allocations/rule > %@",
+      (unsigned long)rules, allocsPerRule, maxAllocs]];
+  }
+
+  double snapshotAllocsPerRule =
+    [run[@"snapshotAllocationsPerRule"] doubleValue];
+  NSNumber *maxSnapshotAllocs = budgets[@"maxSnapshotAllocationsPerRule"];
+  if (   maxSnapshotAllocs
+      && snapshotAllocsPerRule > maxSnapshotAllocs.doubleValue) {
+    [failures addObject:
+     [NSString stringWithFormat:
+      @"%lu rules: %.1f snapshot allocations/rule > %@",
+      (unsigned long)rules, snapshotAllocsPerRule, maxSnapshotAllocs]];
+  }
+
+  NSNumber *maxRSS = budgets[@"maxPeakRSSMegabytes"];
+  double rssMegabytes = [run[@"peakRSS"] doubleValue] / (1024.0 * 1024.0);
+  if (maxRSS && rssMegabytes > maxRSS.doubleValue) {
+    [failures addObject:
+     [NSString stringWithFormat:@"%lu rules: peak RSS %.1f MB > %@ MB",
+      (unsigned long)rules, rssMegabytes, maxRSS]];
+  }
+
+  NSDictionary *opBudgets = budgets[@"operations"];
+  NSDictionary *opStats = run[@"operations"];
+  [opStats enumerateKeysAndObjectsUsingBlock:
+   ^(NSString *op, NSDictionary *stats, BOOL *stop) {
+     NSDictionary *budget = opBudgets[op];
+     double p99 = [stats[@"p99"] doubleValue];
+
+     // p50Speedup makes the comparison stricter: op has to be that many
+     // times faster than the baseline, not just no slower.
+     NSString *baseline = budget[@"p50NoSlowerThan"];
+     if (baseline && opStats[baseline]) {
+       double p50 = [stats[@"p50"] doubleValue];
+       double baselineP50 = [opStats[baseline][@"p50"] doubleValue];
+       double speedup = [budget[@"p50Speedup"] doubleValue] ?: 1.0;
+       if (p50 * speedup > baselineP50) {
+         [failures addObject:
+          [NSString stringWithFormat:
+           @"%lu rules: %@ p50 %.1f us > %@ %.1f us / %.1f",
+           (unsigned long)rules, op, p50 / 1000.0,
+           baseline, baselineP50 / 1000.0, speedup]];
+       }
+     }
+
+     NSNumber *perRule = budget[@"p99NanosPerRule"];
+     if (perRule && p99 > perRule.doubleValue * rules) {
+       [failures addObject:
+        [NSString stringWithFormat:@"%lu rules: %@ p99 %.0f ns/rule > %@",
+         (unsigned long)rules, op, p99 / rules, perRule]];
+     }
+
+     NSNumber *micros = budget[@"p99Micros"];
+     if (micros && p99 > micros.doubleValue * 1000.0) {
+       [failures addObject:
+        [NSString stringWithFormat:@"%lu rules: %@ p99 %.1f us > %@ us",
+         (unsigned long)rules, op, p99 / 1000.0, micros]];
+     }
+   }];
+
+  return failures;
+}
+
+
+// Budgets from the worst of each measurement over every run. Only budgets
+// already in the file are recorded, so it keeps its shape.
+static
+NSDictionary *
+recordBudgets(NSDictionary *budgets, NSArray *runs)
+{
+  NSMutableDictionary *limits = [NSMutableDictionary dictionary];
+  NSMutableDictionary *opLimits = [NSMutableDictionary dictionary];
+
+  void (^worst)(NSMutableDictionary *, NSString *, double) =
+    ^(NSMutableDictionary *dict, NSString *key, double value) {
+      dict[key] = @(MAX([dict[key] doubleValue], value));
+    };
+
+  for (NSDictionary *run in runs) {
+    double rules = [run[@"rules"] doubleValue];
+
+    if (run[@"bytesPerRule"]) {
+      worst(limits, @"maxBytesPerRule", [run[@"bytesPerRule"] doubleValue]);
+      worst(limits, @"maxRetainedBlocksPerRule",
+            [run[@"retainedBlocksPerRule"] doubleValue]);
+      worst(limits, @"maxAllocationsPerRule",
+            [run[@"allocationsPerRule"] doubleValue]);
+      worst(limits, @"maxSnapshotAllocationsPerRule",
+            [run[@"snapshotAllocationsPerRule"] doubleValue]);
+      worst(limits, @"maxPeakRSSMegabytes",
+            [run[@"peakRSS"] doubleValue] / (1024.0 * 1024.0));
+    }
+
+    [run[@"operations"] enumerateKeysAndObjectsUsingBlock:
+     ^(NSString *op, NSDictionary *stats, BOOL *stop) {
+       NSMutableDictionary *limit = opLimits[op];
+       if (limit == nil) {
+         limit = opLimits[op] = [NSMutableDictionary dictionary];
+       }
+       double p99 = [stats[@"p99"] doubleValue];
+       worst(limit, @"p99NanosPerRule", p99 / rules);
+       worst(limit, @"p99Micros", p99 / 1000.0);
+     }];
+  }
+
+  NSMutableDictionary *recorded = [budgets mutableCopy];
+  [limits enumerateKeysAndObjectsUsingBlock:
+   ^(NSString *key, NSNumber *value, BOOL *stop) {
+     if (recorded[key]) {
+       recorded[key] = @(ceil(value.doubleValue * QStressRecordHeadroom));
+     }
+   }];
+
+  NSMutableDictionary *operations = [budgets[@"operations"] mutableCopy];
+  [budgets[@"operations"] enumerateKeysAndObjectsUsingBlock:
+   ^(NSString *op, NSDictionary *budget, BOOL *stop) {
+     NSMutableDictionary *opRecorded = [budget mutableCopy];
+     [opLimits[op] enumerateKeysAndObjectsUsingBlock:
+      ^(NSString *key, NSNumber *value, BOOL *stop) {
+        if (opRecorded[key]) {
+          opRecorded[key] = @(ceil(value.doubleValue * QStressRecordHeadroom));
+        }
+      }];
+     operations[op] = opRecorded;
+   }];
+  recorded[@"operations"] = operations;
+
+  return recorded;
+}
+
+
+static
+void
+printRun(NSDictionary *run)
+{
+  if (run[@"lines"]) {
+    printf("%8lu rules  %8lu preview lines\n",
+           [run[@"rules"] unsignedLongValue],
+           [run[@"lines"] unsignedLongValue]);
+  } else {
+    printf("%8lu rules  %7.1f bytes/rule  %5.1f blocks/rule  "
+           "%6.1f allocs/rule  %4.1f snapshot allocs/rule  "
+           "peak RSS %.1f MB\n",
+           [run[@"rules"] unsignedLongValue],
+           [run[@"bytesPerRule"] doubleValue],
+           [run[@"retainedBlocksPerRule"] doubleValue],
+           [run[@"allocationsPerRule"] doubleValue],
+           [run[@"snapshotAllocationsPerRule"] doubleValue],
+           [run[@"peakRSS"] doubleValue] / (1024.0 * 1024.0));
+  }
+
+  NSDictionary *operations = run[@"operations"];
+  for (NSString *op in run[@"operationNames"]) {
+    NSDictionary *stats = operations[op];
+    printf("    %-20s p50 %10.1f us   p99 %10.1f us   (%lu samples)\n",
+           op.UTF8String,
+           [stats[@"p50"] doubleValue] / 1000.0,
+           [stats[@"p99"] doubleValue] / 1000.0,
+           [stats[@"samples"] unsignedLongValue]);
+  }
+}
+
+
+int
+main(int argc, const char *argv[])
+{
+  @autoreleasepool {
+    // QDocument expects an application instance to exist.
+    [NSApplication sharedApplication];
+
+    NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+
+    // StressBudgets.plist is copied next to the executable at build time.
+    NSString *budgetsPath = [defaults stringForKey:@"budgets"];
+    if (!budgetsPath) {
+      budgetsPath = [[NSBundle mainBundle] pathForResource:@"StressBudgets"
+                                                    ofType:@"plist"];
+    }
+
+    if (!budgetsPath) {
+      fprintf(stderr, "No StressBudgets.plist found, pass -budgets path\n");
+      return 2;
+    }
+
+    NSDictionary *budgets = [NSDictionary dictionaryWithContentsOfFile:budgetsPath];
+    if (!budgets) {
+      fprintf(stderr, "Unable to read budgets from %s\n", budgetsPath.UTF8String);
+      return 2;
+    }
+
+    NSArray *sizes = budgets[@"sizes"];
+    NSString *sizesArg = [defaults stringForKey:@"sizes"];
+    if (sizesArg) {
+      sizes = [[sizesArg componentsSeparatedByString:@","]
+               valueForKey:@"integerValue"];
+    }
+
+    NSString *scratchName =
+      [NSString stringWithFormat:@"schemer-stress-%d", getpid()];
+    NSURL *scratchBase =
+      [NSURL fileURLWithPath:
+       [NSTemporaryDirectory() stringByAppendingPathComponent:scratchName]];
+    NSURL *scratchURL = [scratchBase URLByAppendingPathExtension:@"tmTheme"];
+    NSURL *jsonURL =
+      [scratchBase URLByAppendingPathExtension:@"sublime-color-scheme"];
+
+    NSMutableArray *runs = [NSMutableArray arrayWithCapacity:[sizes count]];
+    NSMutableArray *failures = [NSMutableArray array];
+
+    for (NSNumber *size in sizes) {
+      @autoreleasepool {
+        NSDictionary *run = runScenario(size.unsignedIntegerValue,
+                                         scratchURL,
+                                         jsonURL);
+        printRun(run);
+        [runs addObject:run];
+        [failures addObjectsFromArray:checkBudgets(run, budgets)];
+      }
+    }
+
+    NSUInteger previewRules = [budgets[@"previewRules"] unsignedIntegerValue];
+    NSUInteger previewLines = [budgets[@"previewLines"] unsignedIntegerValue];
+    if (previewRules && previewLines) {
+      @autoreleasepool {
+        NSDictionary *run = runPreviewScenario(previewRules, previewLines);
+        printRun(run);
+        [runs addObject:run];
+        [failures addObjectsFromArray:checkBudgets(run, budgets)];
+      }
+    }
+
+    [[NSFileManager defaultManager] removeItemAtURL:scratchURL error:NULL];
+    [[NSFileManager defaultManager] removeItemAtURL:jsonURL error:NULL];
+    [[NSFileManager defaultManager]
+     removeItemAtURL:[QScheme snapshotURLForURL:scratchURL]
+               error:NULL];
+
+    NSString *outputPath = [defaults stringForKey:@"output"];
+    if (outputPath) {
+      [@{ @"runs": runs, @"failures": failures }
+       writeToFile:outputPath atomically:YES];
+    }
+
+    // Recording is for setting the budgets, so exceeding the old ones doesn't
+    // fail it.
+    NSString *recordPath = [defaults stringForKey:@"record"];
+    if (recordPath) {
+      if (![recordBudgets(budgets, runs) writeToFile:recordPath
+                                          atomically:YES]) {
+        fprintf(stderr, "Unable to write budgets to %s\n",
+                recordPath.UTF8String);
+        return 2;
+      }
+      printf("Recorded budgets to %s\n", recordPath.UTF8String);
+      return 0;
+    }
+
+    for (NSString *failure in failures) {
+      fprintf(stderr, "BUDGET EXCEEDED: %s\n", failure.UTF8String);
+    }
+
+    return [failures count] ? 1 : 0;
+  }
+}
@@ -0,0 +1,396 @@
+/*===========================================================================
+  Copyright (c) 2014, Noel Cower.
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+  IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================*/
+/* QSchemeDiffTests.m - Noel Cower */
+
+#import <XCTest/XCTest.h>
+
+#import "QScheme.h"
+#import "QSchemeDiff.h"
+#import "QSchemeRule.h"
+#import "NSColor+QHexColor.h"
+
+
+// Every instance hashes the same, so pairing has to fall back to -isEqual:.
+@interface QCollidingRule : QSchemeRule
+@end
+
+
+@implementation QCollidingRule
+
+- (uint64_t)contentHash
+{
+  return 42;
+}
+
+@end
+
+
+static
+QSchemeRule *
+makeRule(Class ruleClass, NSString *name, NSString *selector, uint32_t rgba)
+{
+  QSchemeRule *rule = [ruleClass new];
+  rule.name = name;
+  rule.selectors = @[selector];
+  rule.foreground = [NSColor colorFromPackedRGBA:rgba];
+  return rule;
+}
+
+
+static
+QSchemeRule *
+rule(NSString *name, NSString *selector, uint32_t rgba)
+{
+  return makeRule([QSchemeRule class], name, selector, rgba);
+}
+
+
+static
+NSArray *
+sampleRules()
+{
+  return @[
+    rule(@"Comment", @"comment", 0x75715EFF),
+    rule(@"String", @"string", 0xE6DB74FF),
+    rule(@"Number", @"constant.numeric", 0xAE81FFFF),
+    rule(@"Keyword", @"keyword", 0xF92672FF),
+    rule(@"Function", @"entity.name.function", 0xA6E22EFF)
+  ];
+}
+
+
+static
+NSArray *
+copiedRules(NSArray *rules)
+{
+  NSMutableArray *copies = [NSMutableArray arrayWithCapacity:[rules count]];
+  for (QSchemeRule *rule in rules) {
+    [copies addObject:[rule copy]];
+  }
+  return copies;
+}
+
+
+@interface QSchemeDiffTests : XCTestCase
+@end
+
+
+@implementation QSchemeDiffTests
+
+#pragma mark Equality and hashing
+
+- (void)testEqualRulesHashEqual
+{
+  QSchemeRule *rule = sampleRules()[0];
+  QSchemeRule *copy = [rule copy];
+
+  XCTAssertNotEqual(rule, copy);
+  XCTAssertEqualObjects(rule, copy);
+  XCTAssertEqual(rule.contentHash, copy.contentHash);
+  XCTAssertEqual([rule hash], [copy hash]);
+}
+
+
+- (void)testRuleHashTracksEdits
+{
+  QSchemeRule *rule = sampleRules()[0];
+  QSchemeRule *copy = [rule copy];
+  uint64_t original = copy.contentHash;
+
+  NSArray *keys =
+    @[@"name", @"selectors", @"foreground", @"background", @"flags"];
+  for (NSString *key in keys) {
+    copy = [rule copy];
+
+    if ([key isEqualToString:@"name"]) {
+      copy.name = @"Other";
+    } else if ([key isEqualToString:@"selectors"]) {
+      copy.selectors = @[@"comment", @"other"];
+    } else if ([key isEqualToString:@"foreground"]) {
+      copy.foreground = [NSColor blackColor];
+    } else if ([key isEqualToString:@"background"]) {
+      copy.background = [NSColor colorFromPackedRGBA:0x272822FF];
+    } else {
+      copy.flags = @(QBoldFlag);
+    }
+
+    XCTAssertNotEqual(original, copy.contentHash, @"%@", key);
+    XCTAssertNotEqualObjects(rule, copy, @"%@", key);
+  }
+
+  copy = [rule copy];
+  copy.name = @"Other";
+  copy.name = rule.name;
+  XCTAssertEqual(original, copy.contentHash);
+  XCTAssertEqualObjects(rule, copy);
+}
+
+
+- (void)testCollidingRulesAreNotEqual
+{
+  QSchemeRule *left = makeRule([QCollidingRule class], @"A", @"a", 0xFF);
+  QSchemeRule *right = makeRule([QCollidingRule class], @"B", @"b", 0xFF);
+
+  XCTAssertEqual(left.contentHash, right.contentHash);
+  XCTAssertNotEqualObjects(left, right);
+}
+
+
+- (void)testEqualSchemesHashEqual
+{
+  QScheme *scheme = [QScheme new];
+  scheme.foregroundColor = [NSColor whiteColor];
+  scheme.rules = sampleRules();
+
+  QScheme *copy = [scheme copy];
+  XCTAssertEqualObjects(scheme, copy);
+  XCTAssertEqual(scheme.contentHash, copy.contentHash);
+  XCTAssertEqual([scheme hash], [copy hash]);
+
+  copy.foregroundColor = [NSColor blackColor];
+  XCTAssertNotEqualObjects(scheme, copy);
+
+  copy = [scheme copy];
+  [copy.rules[2] setName:@"Other"];
+  XCTAssertNotEqual(scheme.contentHash, copy.contentHash);
+  XCTAssertNotEqualObjects(scheme, copy);
+
+  [copy.rules[2] setName:[scheme.rules[2] name]];
+  XCTAssertEqualObjects(scheme, copy);
+
+  copy.rules = [copy.rules subarrayWithRange:NSMakeRange(0, 4)];
+  XCTAssertNotEqualObjects(scheme, copy);
+
+  XCTAssertNotEqualObjects(scheme, [QScheme new]);
+}
+
+
+- (void)testSchemeHashTracksRuleEdits
+{
+  QScheme *scheme = [QScheme new];
+  scheme.rules = sampleRules();
+  uint64_t original = scheme.contentHash;
+
+  [scheme.rules[3] setFlags:@(QItalicFlag)];
+  XCTAssertNotEqual(original, scheme.contentHash);
+  XCTAssertEqual(scheme.contentHash, [[scheme copy] contentHash]);
+
+  [scheme.rules[3] setFlags:@(QNoFlags)];
+  XCTAssertEqual(original, scheme.contentHash);
+
+  // The rules can only report changes to the first scheme that hashed them,
+  // so the second has to notice edits some other way.
+  QScheme *sharing = [scheme copy];
+  sharing.rules = scheme.rules;
+  uint64_t shared = sharing.contentHash;
+  XCTAssertEqual(original, shared);
+
+  [scheme.rules[0] setName:@"Other"];
+  XCTAssertNotEqual(original, scheme.contentHash);
+  XCTAssertNotEqual(shared, sharing.contentHash);
+  XCTAssertEqual(scheme.contentHash, sharing.contentHash);
+
+  // Once the first scheme lets go of a rule, the next one to hash it tracks it.
+  scheme.rules = @[];
+  XCTAssertEqual(scheme.contentHash, [[scheme copy] contentHash]);
+  sharing.rules = [sharing.rules arrayByAddingObject:rule(@"New", @"new", 0)];
+  shared = sharing.contentHash;
+  [sharing.rules[0] setName:@"Comment"];
+  XCTAssertNotEqual(shared, sharing.contentHash);
+  XCTAssertEqual(sharing.contentHash, [[sharing copy] contentHash]);
+}
+
+
+#pragma mark Diffs
+
+- (void)testIdenticalRulesAreEmpty
+{
+  NSArray *rules = sampleRules();
+  QSchemeDiff *diff =
+    [QSchemeDiff diffFromRules:rules toRules:copiedRules(rules)];
+
+  XCTAssertTrue(diff.empty);
+}
+
+
+- (void)testInsert
+{
+  NSArray *rules = sampleRules();
+  NSMutableArray *newRules = copiedRules(rules).mutableCopy;
+  [newRules insertObject:rule(@"Tag", @"entity.name.tag", 0xF92672FF)
+                 atIndex:2];
+  [newRules addObject:rule(@"Storage", @"storage", 0x66D9EFFF)];
+
+  QSchemeDiff *diff = [QSchemeDiff diffFromRules:rules toRules:newRules];
+
+  NSMutableIndexSet *inserted = [NSMutableIndexSet indexSetWithIndex:2];
+  [inserted addIndex:6];
+  XCTAssertEqualObjects(diff.insertedIndexes, inserted);
+  XCTAssertEqual([diff.removedIndexes count], (NSUInteger)0);
+  XCTAssertEqual([diff.movedIndexes count], (NSUInteger)0);
+  XCTAssertEqual([diff.modifiedIndexes count], (NSUInteger)0);
+}
+
+
+- (void)testRemove
+{
+  NSArray *rules = sampleRules();
+  NSMutableArray *newRules = copiedRules(rules).mutableCopy;
+  [newRules removeObjectAtIndex:4];
+  [newRules removeObjectAtIndex:1];
+
+  QSchemeDiff *diff = [QSchemeDiff diffFromRules:rules toRules:newRules];
+
+  NSMutableIndexSet *removed = [NSMutableIndexSet indexSetWithIndex:1];
+  [removed addIndex:4];
+  XCTAssertEqualObjects(diff.removedIndexes, removed);
+  XCTAssertEqual([diff.insertedIndexes count], (NSUInteger)0);
+  XCTAssertEqual([diff.movedIndexes count], (NSUInteger)0);
+  XCTAssertEqual([diff.modifiedIndexes count], (NSUInteger)0);
+}
+
+
+- (void)testMove
+{
+  NSArray *rules = sampleRules();
+  NSMutableArray *newRules = copiedRules(rules).mutableCopy;
+  QSchemeRule *moved = newRules[0];
+  [newRules removeObjectAtIndex:0];
+  [newRules insertObject:moved atIndex:3];
+
+  QSchemeDiff *diff = [QSchemeDiff diffFromRules:rules toRules:newRules];
+
+  XCTAssertEqualObjects(diff.movedIndexes, @{ @0: @3 });
+  XCTAssertEqual([diff.insertedIndexes count], (NSUInteger)0);
+  XCTAssertEqual([diff.removedIndexes count], (NSUInteger)0);
+  XCTAssertEqual([diff.modifiedIndexes count], (NSUInteger)0);
+}
+
+
+- (void)testModify
+{
+  NSArray *rules = sampleRules();
+  NSArray *newRules = copiedRules(rules);
+  [newRules[1] setForeground:[NSColor redColor]];
+  [newRules[3] setSelectors:@[@"keyword", @"storage"]];
+
+  QSchemeDiff *diff = [QSchemeDiff diffFromRules:rules toRules:newRules];
+
+  XCTAssertEqualObjects(diff.modifiedIndexes, (@{ @1: @1, @3: @3 }));
+  XCTAssertEqual([diff.insertedIndexes count], (NSUInteger)0);
+  XCTAssertEqual([diff.removedIndexes count], (NSUInteger)0);
+  XCTAssertEqual([diff.movedIndexes count], (NSUInteger)0);
+}
+
+
+- (void)testRenamedRulePairsBySelectors
+{
+  NSArray *rules = sampleRules();
+  NSArray *newRules = copiedRules(rules);
+  [newRules[2] setName:@"Numeric"];
+  [newRules[2] setForeground:[NSColor redColor]];
+
+  QSchemeDiff *diff = [QSchemeDiff diffFromRules:rules toRules:newRules];
+
+  XCTAssertEqualObjects(diff.modifiedIndexes, @{ @2: @2 });
+  XCTAssertEqual([diff.insertedIndexes count], (NSUInteger)0);
+  XCTAssertEqual([diff.removedIndexes count], (NSUInteger)0);
+}
+
+
+- (void)testDuplicateRulesPairInOrder
+{
+  QSchemeRule *duplicate = rule(@"Dup", @"dup", 0x112233FF);
+  NSArray *rules = @[
+    duplicate,
+    rule(@"Other", @"other", 0x445566FF),
+    [duplicate copy],
+    [duplicate copy]
+  ];
+
+  // Removing the middle duplicate removes the second one, not the last.
+  NSArray *removedMiddle = @[rules[0], rules[1], rules[3]];
+  QSchemeDiff *diff = [QSchemeDiff diffFromRules:rules toRules:removedMiddle];
+  XCTAssertEqual([diff.removedIndexes count], (NSUInteger)1);
+  XCTAssertEqual([diff.insertedIndexes count], (NSUInteger)0);
+  XCTAssertEqual([diff.movedIndexes count], (NSUInteger)0);
+
+  // Adding another duplicate is one insertion, wherever it lands.
+  NSArray *added = @[[duplicate copy], rules[0], rules[1], rules[2], rules[3]];
+  diff = [QSchemeDiff diffFromRules:rules toRules:added];
+  XCTAssertEqual([diff.insertedIndexes count], (NSUInteger)1);
+  XCTAssertEqual([diff.removedIndexes count], (NSUInteger)0);
+  XCTAssertEqual([diff.movedIndexes count], (NSUInteger)0);
+  XCTAssertEqual([diff.modifiedIndexes count], (NSUInteger)0);
+
+  // Swapping two identical rules isn't a change.
+  NSArray *swapped = @[rules[2], rules[1], rules[0], rules[3]];
+  XCTAssertTrue([QSchemeDiff diffFromRules:rules toRules:swapped].empty);
+}
+
+
+- (void)testHashCollisionsAreNotPaired
+{
+  Class colliding = [QCollidingRule class];
+  NSArray *rules = @[
+    makeRule(colliding, @"A", @"a", 0x111111FF),
+    makeRule(colliding, @"B", @"b", 0x222222FF)
+  ];
+
+  // Nothing in common but the hash -- a removal and an insertion.
+  NSArray *replaced = @[rules[0], makeRule(colliding, @"C", @"c", 0x333333FF)];
+  QSchemeDiff *diff = [QSchemeDiff diffFromRules:rules toRules:replaced];
+  XCTAssertEqualObjects(diff.removedIndexes, [NSIndexSet indexSetWithIndex:1]);
+  XCTAssertEqualObjects(diff.insertedIndexes, [NSIndexSet indexSetWithIndex:1]);
+  XCTAssertEqual([diff.modifiedIndexes count], (NSUInteger)0);
+
+  // Every candidate collides, so each rule has to find its equal rather than
+  // the first rule with the same hash.
+  NSArray *swapped = @[[rules[1] copy], [rules[0] copy]];
+  diff = [QSchemeDiff diffFromRules:rules toRules:swapped];
+  XCTAssertEqual([diff.movedIndexes count], (NSUInteger)1);
+  XCTAssertEqual([diff.modifiedIndexes count], (NSUInteger)0);
+  XCTAssertEqual([diff.insertedIndexes count], (NSUInteger)0);
+  XCTAssertEqual([diff.removedIndexes count], (NSUInteger)0);
+}
+
+
+- (void)testSchemeDiff
+{
+  QScheme *scheme = [QScheme new];
+  scheme.rules = sampleRules();
+
+  QScheme *copy = [scheme copy];
+  XCTAssertTrue([QSchemeDiff diffFromScheme:scheme toScheme:copy].empty);
+
+  copy.rules = [copy.rules arrayByAddingObject:rule(@"New", @"new", 0xFF)];
+  QSchemeDiff *diff = [QSchemeDiff diffFromScheme:scheme toScheme:copy];
+  XCTAssertEqualObjects(diff.insertedIndexes, [NSIndexSet indexSetWithIndex:5]);
+}
+
+@end
@@ -0,0 +1,250 @@
+/*===========================================================================
+  Copyright (c) 2014, Noel Cower.
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+  IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================*/
+
+/* QSchemeJSONTests.m - Noel Cower */
+
+#import <XCTest/XCTest.h>
+
+#import "QScheme.h"
+#import "QScheme+QJSON.h"
+#import "QSchemeRule.h"
+#import "NSColor+QHexColor.h"
+
+
+static
+uint32_t
+packed(NSColor *color)
+{
+  return [color toPackedRGBA];
+}
+
+
+@interface QSchemeJSONTests : XCTestCase
+@end
+
+
+// The sample theme shared by the scheme tests, SchemerTests/Sample.tmTheme.
+static
+NSDictionary *
+samplePropertyList()
+{
+  NSURL *url = [[NSBundle bundleForClass:[QSchemeJSONTests class]]
+                URLForResource:@"Sample" withExtension:@"tmTheme"];
+  return [NSDictionary dictionaryWithContentsOfURL:url];
+}
+
+
+@implementation QSchemeJSONTests
+
+- (QScheme *)schemeFromJSON:(NSString *)json error:(NSError **)outError
+{
+  NSData *data = [json dataUsingEncoding:NSUTF8StringEncoding];
+  return [[QScheme alloc] initWithJSONData:data error:outError];
+}
+
+
+- (void)testPropertyListRoundTripsThroughJSON
+{
+  QScheme *scheme = [[QScheme alloc] initWithPropertyList:samplePropertyList()];
+  XCTAssertNotNil(scheme);
+
+  NSError *error = nil;
+  NSData *json = [scheme toJSONDataWithName:@"Sample"];
+  QScheme *reread = [[QScheme alloc] initWithJSONData:json error:&error];
+
+  XCTAssertNotNil(reread, @"%@", error);
+  XCTAssertEqual(scheme.contentHash, reread.contentHash);
+  XCTAssertEqualObjects(scheme, reread);
+}
+
+
+- (void)testJSONRoundTripsThroughPropertyList
+{
+  QScheme *scheme = [[QScheme alloc] initWithPropertyList:samplePropertyList()];
+  NSData *json = [scheme toJSONDataWithName:@"Sample"];
+  QScheme *fromJSON = [[QScheme alloc] initWithJSONData:json error:NULL];
+  QScheme *fromPlist =
+    [[QScheme alloc] initWithPropertyList:[fromJSON toPropertyList]];
+
+  XCTAssertEqualObjects(scheme, fromPlist);
+}
+
+
+- (void)testColorFunctions
+{
+  NSError *error = nil;
+  QScheme *scheme = [self schemeFromJSON:
+    @"{\n"
+    @"  // Variables may come after their uses.\n"
+    @"  \"globals\": {\n"
+    @"    \"foreground\": \"rgba(10, 20, 30, 0.5)\",\n"
+    @"    \"background\": \"var(base)\",\n"
+    @"    \"caret\": \"rebeccapurple\",\n"
+    @"    \"selection\": \"color(var(accent) alpha(0.5))\",\n"
+    @"    \"line_highlight\": \"color(var(accent) a(-0.75))\",\n"
+    @"  },\n"
+    @"  \"rules\": [\n"
+    @"    { \"scope\": \"a\", \"foreground\": \"rgb(255, 0, 0)\" },\n"
+    @"    { \"scope\": \"b\", \"foreground\": \"rgba(0, 128, 255, 0.5)\" },\n"
+    @"    { \"scope\": \"c\", \"foreground\": \"hsl(120, 100%, 50%)\" },\n"
+    @"    { \"scope\": \"d\", \"foreground\": \"hsla(240deg, 100%, 50%, 25%)\" },\n"
+    @"    { \"scope\": \"e\", \"foreground\": \"rgb(0 0 255 / 100%)\" },\n"
+    @"    { \"scope\": \"f\", \"foreground\": \"color(#000 blend(#fff 50%))\" },\n"
+    @"    { \"scope\": \"g\", \"foreground\": \"color(#808080 l(+20%))\" },\n"
+    @"  ],\n"
+    @"  \"variables\": {\n"
+    @"    \"base\": \"var(accent)\",\n"
+    @"    \"accent\": \"#336699\",\n"
+    @"    \"font\": \"Menlo\"\n"
+    @"  }\n"
+    @"}\n"
+                                          error:&error];
+
+  XCTAssertNotNil(scheme, @"%@", error);
+
+  // The scheme's foreground and background are always opaque.
+  XCTAssertEqual(packed(scheme.foregroundColor), 0x0A141EFFU);
+  XCTAssertEqual(packed(scheme.backgroundColor), 0x336699FFU);
+  XCTAssertEqual(packed(scheme.caretColor), 0x663399FFU);
+  XCTAssertEqual(packed(scheme.selectionColor), 0x33669980U);
+  XCTAssertEqual(packed(scheme.lineHighlightColor), 0x33669940U);
+
+  NSArray *rules = scheme.rules;
+  XCTAssertEqual([rules count], (NSUInteger)7);
+  XCTAssertEqual(packed([rules[0] foreground]), 0xFF0000FFU);
+  XCTAssertEqual(packed([rules[1] foreground]), 0x0080FF80U);
+  XCTAssertEqual(packed([rules[2] foreground]), 0x00FF00FFU);
+  XCTAssertEqual(packed([rules[3] foreground]), 0x0000FF40U);
+  XCTAssertEqual(packed([rules[4] foreground]), 0x0000FFFFU);
+  XCTAssertEqual(packed([rules[5] foreground]), 0x808080FFU);
+  XCTAssertEqual(packed([rules[6] foreground]), 0xB3B3B3FFU);
+}
+
+
+- (void)testUnsupportedColorsFail
+{
+  NSError *error = nil;
+  QScheme *scheme = [self schemeFromJSON:
+    @"{ \"globals\": { \"foreground\": \"color(#fff min-contrast(#000 4.5))\" },"
+    @"  \"rules\": [] }"
+                                          error:&error];
+
+  XCTAssertNil(scheme);
+  XCTAssertEqualObjects(error.domain, QInvalidJSONErrorDomain);
+  XCTAssertEqual(error.code, (NSInteger)3);
+  XCTAssertEqualObjects(error.userInfo[@"values"],
+                        @[@"color(#fff min-contrast(#000 4.5))"]);
+}
+
+
+- (void)testUndefinedAndCyclicVariablesFail
+{
+  NSError *error = nil;
+  QScheme *scheme = [self schemeFromJSON:
+    @"{ \"variables\": { \"a\": \"var(b)\", \"b\": \"var(a)\" },"
+    @"  \"globals\": { \"caret\": \"var(a)\", \"selection\": \"var(nope)\" } }"
+                                          error:&error];
+
+  XCTAssertNil(scheme);
+  XCTAssertEqual(error.code, (NSInteger)3);
+  XCTAssertEqual([error.userInfo[@"values"] count], (NSUInteger)2);
+}
+
+
+
+- (void)testInvalidUTF8Fails
+{
+  // Each document has a lone 0xFF byte spliced in at the '~'.
+  NSArray *documents = @[
+    @"{ \"globals\": {}, \"rules\": [{ \"scope\": \"a, b~\" }] }",
+    @"{ \"globals\": {}, \"rules\": [{ \"name\": \"~\" }] }",
+    @"{ \"globals\": { \"caret\": \"rgb(~)\" } }",
+    @"{ \"variables\": { \"~\": \"#fff\" }, \"globals\": {} }",
+    @"{ \"variables\": { \"a\": \"~\" }, \"globals\": {} }",
+    @"{ \"globals\": {}, \"uuid\": \"~\" }"
+  ];
+
+  for (NSString *document in documents) {
+    NSMutableData *data =
+      [[document dataUsingEncoding:NSUTF8StringEncoding] mutableCopy];
+    uint8_t *bytes = (uint8_t *)data.mutableBytes;
+    uint8_t *tilde = memchr(bytes, '~', data.length);
+    *tilde = 0xFF;
+
+    NSError *error = nil;
+    QScheme *scheme = [[QScheme alloc] initWithJSONData:data error:&error];
+
+    XCTAssertNil(scheme, @"%@", document);
+    XCTAssertEqualObjects(error.domain, QInvalidJSONErrorDomain,
+                          @"%@", document);
+    XCTAssertEqual(error.code, (NSInteger)1, @"%@", document);
+  }
+}
+
+- (void)testMalformedDocumentsFail
+{
+  NSArray *documents = @[
+    @"{ \"globals\": {} \"rules\": [] }",
+    @"{ \"globals\": { \"caret\": \"#fff\" \"invisibles\": \"#000\" } }",
+    @"{ \"globals\": {}, \"extra\": [1 2] }",
+    @"{ \"globals\": {}, \"extra\": [1,, 2] }",
+    @"{ \"globals\": {}, , \"extra\": 1 }",
+    @"{ \"globals\": {}, \"extra\": nope }",
+    @"{ \"globals\": {}, \"extra\": 01 }",
+    @"{ \"globals\": {}, \"extra\": 1. }",
+    @"{ \"globals\": {}, \"extra\": truex }",
+    @"{ \"globals\": {} } trailing",
+    @"{ \"globals\": {} } {}",
+    @"{ \"globals\": {}"
+  ];
+
+  for (NSString *document in documents) {
+    NSError *error = nil;
+    XCTAssertNil([self schemeFromJSON:document error:&error], @"%@", document);
+    XCTAssertEqual(error.code, (NSInteger)1, @"%@", document);
+  }
+}
+
+
+- (void)testLenientSyntaxIsAccepted
+{
+  // Comments, trailing commas, and every kind of literal Sublime accepts.
+  NSString *document =
+    @"// leading comment\n"
+    @"{\n"
+    @"  \"globals\": { \"caret\": \"#fff\", },\n"
+    @"  \"extra\": [true, false, null, -1.5e+3, 0, \"s\", {}, [],],\n"
+    @"  /* block */ \"rules\": [],\n"
+    @"}\n"
+    @"// trailing comment\n";
+
+  NSError *error = nil;
+  XCTAssertNotNil([self schemeFromJSON:document error:&error], @"%@", error);
+}
+
+@end
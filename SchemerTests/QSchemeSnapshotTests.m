@@ -0,0 +1,323 @@
+/*===========================================================================
+  Copyright (c) 2014, Noel Cower.
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+  IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+  HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+===========================================================================*/
+/* QSchemeSnapshotTests.m - Noel Cower */
+
+#import <XCTest/XCTest.h>
+
+#import "QDocument.h"
+#import "QScheme.h"
+#import "QScheme+QSnapshot.h"
+#import "QSchemeRule.h"
+#import "NSColor+QHexColor.h"
+
+
+static NSString *const QThemeType = @"tmTheme";
+
+
+@interface QSchemeSnapshotTests : XCTestCase
+@end
+
+
+// The sample theme shared by the scheme tests, SchemerTests/Sample.tmTheme.
+static
+NSDictionary *
+samplePropertyList()
+{
+  NSURL *url = [[NSBundle bundleForClass:[QSchemeSnapshotTests class]]
+                URLForResource:@"Sample" withExtension:@"tmTheme"];
+  return [NSDictionary dictionaryWithContentsOfURL:url];
+}
+
+
+@implementation QSchemeSnapshotTests {
+  NSURL *_themeURL;
+  NSDate *_modified;
+  QScheme *_scheme;
+}
+
+- (void)setUp
+{
+  [super setUp];
+
+  NSString *name =
+    [NSString stringWithFormat:@"QSchemeSnapshotTests-%@.tmTheme",
+     [[NSUUID UUID] UUIDString]];
+  _themeURL = [NSURL fileURLWithPath:
+               [NSTemporaryDirectory() stringByAppendingPathComponent:name]];
+  _modified = [NSDate dateWithTimeIntervalSinceReferenceDate:400000000.0];
+  _scheme = [[QScheme alloc] initWithPropertyList:samplePropertyList()];
+
+  XCTAssertTrue([samplePropertyList() writeToURL:_themeURL atomically:YES]);
+}
+
+
+- (void)tearDown
+{
+  NSFileManager *manager = [NSFileManager defaultManager];
+  [manager removeItemAtURL:[QScheme snapshotURLForURL:_themeURL] error:NULL];
+  [manager removeItemAtURL:_themeURL error:NULL];
+
+  [super tearDown];
+}
+
+
+- (NSMutableData *)snapshotData
+{
+  return [[_scheme toSnapshotDataWithSourceSize:1234 modifiedDate:_modified]
+          mutableCopy];
+}
+
+
+- (QScheme *)schemeFromSnapshotData:(NSData *)data
+{
+  return [[QScheme alloc] initWithSnapshotData:data
+                                    sourceSize:1234
+                                  modifiedDate:_modified];
+}
+
+
+- (void)testRoundTrip
+{
+  QScheme *reread = [self schemeFromSnapshotData:[self snapshotData]];
+
+  XCTAssertNotNil(reread);
+  XCTAssertEqualObjects(_scheme, reread);
+}
+
+
+- (void)testEditingSnapshotRules
+{
+  QScheme *reread = [self schemeFromSnapshotData:[self snapshotData]];
+
+  // Hashes come from the records, before any rule has decoded its fields.
+  XCTAssertEqual(reread.contentHash, _scheme.contentHash);
+
+  // Setting one field first decodes the rest of the record.
+  QSchemeRule *original = _scheme.rules[0];
+  QSchemeRule *rule = reread.rules[0];
+  rule.selectors = @[@"edited"];
+
+  XCTAssertEqualObjects(rule.name, original.name);
+  XCTAssertEqual([rule.foreground toPackedRGBA],
+                 [original.foreground toPackedRGBA]);
+  XCTAssertEqual([rule.background toPackedRGBA],
+                 [original.background toPackedRGBA]);
+  XCTAssertEqualObjects(rule.flags, original.flags);
+  XCTAssertNotEqual(reread.contentHash, _scheme.contentHash);
+
+  QSchemeRule *edited = [original copy];
+  edited.selectors = @[@"edited"];
+  XCTAssertEqualObjects(rule, edited);
+  XCTAssertEqual(rule.contentHash, edited.contentHash);
+  XCTAssertEqualObjects([rule copy], edited);
+}
+
+
+- (void)testStaleSnapshotsAreRejected
+{
+  NSData *data = [self snapshotData];
+
+  XCTAssertNil([[QScheme alloc] initWithSnapshotData:data
+                                          sourceSize:1235
+                                        modifiedDate:_modified]);
+  XCTAssertNil([[QScheme alloc]
+                initWithSnapshotData:data
+                          sourceSize:1234
+                        modifiedDate:[_modified dateByAddingTimeInterval:1.0]]);
+}
+
+
+- (void)testCorruptSnapshotsAreRejected
+{
+  NSMutableData *data = [self snapshotData];
+  NSUInteger length = [data length];
+  uint8_t *bytes = (uint8_t *)[data mutableBytes];
+
+  // Damage to the header colors, the rule records, and the string blob.
+  for (NSUInteger offset = 40; offset < length; offset += length / 7) {
+    bytes[offset] ^= 0x10;
+    XCTAssertNil([self schemeFromSnapshotData:data], @"offset %lu",
+                 (unsigned long)offset);
+    bytes[offset] ^= 0x10;
+  }
+
+  XCTAssertNotNil([self schemeFromSnapshotData:data]);
+
+  [data setLength:length - 1];
+  XCTAssertNil([self schemeFromSnapshotData:data]);
+
+  [data setLength:length + 8];
+  XCTAssertNil([self schemeFromSnapshotData:data]);
+
+  XCTAssertNil([self schemeFromSnapshotData:[NSData data]]);
+}
+
+
+- (void)testWrongVersionsAreRejected
+{
+  NSMutableData *data = [self snapshotData];
+  uint8_t *bytes = (uint8_t *)[data mutableBytes];
+
+  // The version is the uint16_t following the 32-bit magic, which precede the
+  // checksum, so only the version check can catch this.
+  uint16_t version = 0;
+  memcpy(&version, bytes + 4, sizeof(version));
+  version += 1;
+  memcpy(bytes + 4, &version, sizeof(version));
+  XCTAssertNil([self schemeFromSnapshotData:data]);
+
+  data = [self snapshotData];
+  bytes = (uint8_t *)[data mutableBytes];
+  bytes[0] ^= 0xFF;
+  XCTAssertNil([self schemeFromSnapshotData:data]);
+}
+
+
+- (void)testDocumentFallsBackToPropertyList
+{
+  NSURL *snapshotURL = [QScheme snapshotURLForURL:_themeURL];
+  NSError *error = nil;
+
+  QDocument *document = [QDocument new];
+  XCTAssertTrue([document readFromURL:_themeURL ofType:QThemeType error:&error],
+                @"%@", error);
+  [QDocument waitForSnapshotWrites];
+  XCTAssertNotNil([[QScheme alloc] initWithSnapshotOfURL:_themeURL]);
+
+  // Corrupt the snapshot the read left behind.
+  NSMutableData *data = [NSMutableData dataWithContentsOfURL:snapshotURL];
+  uint8_t *bytes = (uint8_t *)[data mutableBytes];
+  bytes[[data length] - 1] ^= 0xFF;
+  XCTAssertTrue([data writeToURL:snapshotURL atomically:YES]);
+  XCTAssertNil([[QScheme alloc] initWithSnapshotOfURL:_themeURL]);
+
+  document = [QDocument new];
+  XCTAssertTrue([document readFromURL:_themeURL ofType:QThemeType error:&error],
+                @"%@", error);
+  [QDocument waitForSnapshotWrites];
+  XCTAssertEqualObjects(document.scheme, _scheme);
+
+  // Falling back rewrites the snapshot.
+  XCTAssertEqualObjects([[QScheme alloc] initWithSnapshotOfURL:_themeURL],
+                        _scheme);
+
+  // A snapshot for an older version of the file is ignored.
+  NSMutableDictionary *plist = [samplePropertyList() mutableCopy];
+  plist[@"name"] = @"Changed";
+  XCTAssertTrue([plist writeToURL:_themeURL atomically:YES]);
+  XCTAssertNil([[QScheme alloc] initWithSnapshotOfURL:_themeURL]);
+}
+
+
+- (void)testSavedSnapshotMatchesFile
+{
+  NSError *error = nil;
+  QDocument *document = [QDocument new];
+  XCTAssertTrue([document readFromURL:_themeURL ofType:QThemeType error:&error],
+                @"%@", error);
+  [QDocument waitForSnapshotWrites];
+
+  // Neither survives being written to and read back from a property list:
+  // the base foreground is always read as opaque, and invisible rule colors
+  // aren't written.
+  QScheme *scheme = document.scheme;
+  scheme.foregroundColor = [NSColor colorFromPackedRGBA:0xF8F8F280];
+  [scheme.rules[0] setForeground:[NSColor colorFromPackedRGBA:0xFF000000]];
+
+  XCTAssertTrue([document writeSafelyToURL:_themeURL
+                                    ofType:QThemeType
+                          forSaveOperation:NSSaveOperation
+                                     error:&error], @"%@", error);
+  [QDocument waitForSnapshotWrites];
+
+  NSDictionary *plist = [NSDictionary dictionaryWithContentsOfURL:_themeURL];
+  QScheme *fromFile = [[QScheme alloc] initWithPropertyList:plist];
+  QScheme *fromSnapshot = [[QScheme alloc] initWithSnapshotOfURL:_themeURL];
+
+  XCTAssertNotNil(fromSnapshot);
+  XCTAssertNotEqualObjects(fromFile, scheme);
+  XCTAssertEqualObjects(fromSnapshot, fromFile);
+}
+
+
+
+- (void)testAutosavingElsewhereWritesNoSnapshot
+{
+  NSError *error = nil;
+  NSURL *autosaveURL =
+    [[_themeURL URLByDeletingPathExtension]
+     URLByAppendingPathExtension:@"autosave.tmTheme"];
+
+  QDocument *document = [QDocument new];
+  XCTAssertTrue([document readFromURL:_themeURL ofType:QThemeType error:&error],
+                @"%@", error);
+  XCTAssertTrue([document writeSafelyToURL:autosaveURL
+                                    ofType:QThemeType
+                          forSaveOperation:NSAutosaveElsewhereOperation
+                                     error:&error], @"%@", error);
+  [QDocument waitForSnapshotWrites];
+
+  NSURL *snapshotURL = [QScheme snapshotURLForURL:autosaveURL];
+  XCTAssertFalse([snapshotURL checkResourceIsReachableAndReturnError:NULL]);
+
+  [[NSFileManager defaultManager] removeItemAtURL:autosaveURL error:NULL];
+}
+
+
+- (void)testTrimmingRemovesOldestSnapshots
+{
+  NSError *error = nil;
+  NSURL *snapshotURL = [QScheme snapshotURLForURL:_themeURL];
+  NSURL *directory = [snapshotURL URLByDeletingLastPathComponent];
+  NSFileManager *manager = [NSFileManager defaultManager];
+
+  XCTAssertTrue([_scheme writeSnapshotForURL:_themeURL error:&error],
+                @"%@", error);
+
+  // Backdated so it's the oldest snapshot in the cache, whatever else is
+  // there, and the only one trimming a single entry can remove.
+  NSDate *epoch = [NSDate dateWithTimeIntervalSince1970:0];
+  XCTAssertTrue([manager setAttributes:@{ NSFileModificationDate: epoch }
+                          ofItemAtPath:snapshotURL.path
+                                 error:&error], @"%@", error);
+
+  NSArray *names = [manager contentsOfDirectoryAtPath:directory.path
+                                                error:NULL];
+  NSUInteger count =
+    [[names filteredArrayUsingPredicate:
+      [NSPredicate predicateWithFormat:@"self ENDSWITH '.qscs'"]] count];
+  XCTAssertGreaterThan(count, (NSUInteger)0);
+
+  [QScheme trimSnapshotsToCount:count bytes:UINT64_MAX];
+  XCTAssertTrue([snapshotURL checkResourceIsReachableAndReturnError:NULL]);
+
+  [QScheme trimSnapshotsToCount:count - 1 bytes:UINT64_MAX];
+  XCTAssertFalse([snapshotURL checkResourceIsReachableAndReturnError:NULL]);
+}
+
+@end